@@ -0,0 +1,224 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "Cassandra.h"
+
+namespace Cass {
+
+	// A list of packed states, each one preceded by its size
+	struct PackedLevel {
+		unsigned char *data;
+		size_t used;
+		size_t capacity;
+		long count;
+
+		PackedLevel () : data (NULL), used (0), capacity (0), count (0) {}
+
+		~PackedLevel () {
+			release (data, capacity, MEMORY_EXPLORER);
+		}
+
+		// Make room for a state of the given size and return where it must be packed
+		unsigned char *reserve (int size) {
+			if (used + sizeof (int) + size > capacity) {
+				size_t new_capacity = 2 * (used + sizeof (int) + size);
+				data = (unsigned char *)reallocate (data, capacity, new_capacity, MEMORY_EXPLORER);
+				capacity = new_capacity;
+			}
+			return data + used + sizeof (int);
+		}
+
+		// Keep the state packed at reserve ()
+		void commit (int size) {
+			memcpy (data + used, &size, sizeof (int));
+			used += sizeof (int) + size;
+			count++;
+		}
+
+		void clear () {
+			used = 0;
+			count = 0;
+		}
+	};
+
+	// Breadth-first exploration (bitstate hashing) which does not store visited states,
+	// only sets NUM_HASHES bits per state in a large bit array, derived from a 64-bit
+	// fingerprint of the packed state. A state is considered visited if all its bits are
+	// already set, which is sometimes wrong: different states can share all bits.
+	class BitstateExplorer : public Explorer {
+	private:
+		static const int NUM_HASHES = 3;
+
+		int num_inputs;
+		unsigned char *bits;
+		unsigned long long bit_mask;
+		unsigned long long num_bits_set;
+		// Any state, needed to unpack the others
+		State *template_state;
+		// States to expand, and their children
+		PackedLevel *level;
+		PackedLevel *next_level;
+
+		long num_states;
+		int depth;
+		int goal_distance;
+
+		// FNV-1a followed by a final mix, so all bits depend on all bytes
+		static unsigned long long get_fingerprint (const unsigned char *data, int size) {
+			unsigned long long h = 14695981039346656037ull;
+			for (int i = 0; i < size; i++) {
+				h ^= data[i];
+				h *= 1099511628211ull;
+			}
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return h;
+		}
+
+		// Set the bits of this state. Returns false if they were all set already.
+		bool add_fingerprint (unsigned long long fingerprint) {
+			unsigned long long step = (fingerprint >> 32) | 1;
+			bool is_new = false;
+			for (int i = 0; i < NUM_HASHES; i++) {
+				unsigned long long bit = (fingerprint + i * step) & bit_mask;
+				unsigned char mask = 1 << (bit & 7);
+				if (!(bits[bit >> 3] & mask)) {
+					bits[bit >> 3] |= mask;
+					num_bits_set++;
+					is_new = true;
+				}
+			}
+			return is_new;
+		}
+
+		// Add the state to the next level if it has not been visited yet
+		void add_state (const State *state, int distance) {
+			int size = state->pack (NULL, 0);
+			if (size < 0) {
+				printf ("States do not support packing!\n");
+				return;
+			}
+			unsigned char *packed = next_level->reserve (size);
+			state->pack (packed, size);
+			if (!add_fingerprint (get_fingerprint (packed, size)))
+				return;
+
+			next_level->commit (size);
+			num_states++;
+			if (goal_distance < 0 && state->has_won ())
+				goal_distance = distance;
+		}
+
+	public:
+		// More bits than this are taken for a mistake
+		static const int MAX_LOG2_BITS = 36;
+
+		BitstateExplorer (int num_inputs) : num_inputs (num_inputs), bits (NULL), bit_mask (0), num_bits_set (0),
+				template_state (NULL), num_states (0), depth (0), goal_distance (-1) {
+			level = new PackedLevel;
+			next_level = new PackedLevel;
+		}
+
+		~BitstateExplorer () {
+			release (bits, (size_t)((bit_mask + 1) >> 3), MEMORY_EXPLORER);
+			delete level;
+			delete next_level;
+			delete template_state;
+		}
+
+		// Allocate 2^log2_bits bits, at least one byte. Returns false if there is no
+		// memory for them.
+		bool allocate_bits (int log2_bits) {
+			if (log2_bits < 3)
+				log2_bits = 3;
+			bits = (unsigned char *)try_allocate_zeroed ((size_t)(1ull << (log2_bits - 3)), MEMORY_EXPLORER);
+			if (!bits)
+				return false;
+			bit_mask = (1ull << log2_bits) - 1;
+			return true;
+		}
+
+		void add_start_point (const State *state) {
+			template_state = state->clone ();
+			add_state (state, 0);
+			PackedLevel *tmp = level;
+			level = next_level;
+			next_level = tmp;
+		}
+
+		bool process () {
+			if (done ())
+				return true;
+			CASS_TRACE ("explore level");
+
+			size_t offset = 0;
+			while (offset < level->used) {
+				int size;
+				memcpy (&size, level->data + offset, sizeof (int));
+				State *state = template_state->unpack (level->data + offset + sizeof (int), size);
+				// Children may reallocate next_level, but never level
+				for (int i = 0; i < num_inputs; i++) {
+					State *child = state->get_transition (i);
+					if (!child)
+						continue;
+					add_state (child, depth + 1);
+					delete child;
+				}
+				delete state;
+				offset += sizeof (int) + size;
+			}
+
+			// Expanded states are forgotten
+			PackedLevel *tmp = level;
+			level = next_level;
+			next_level = tmp;
+			next_level->clear ();
+			if (level->count > 0)
+				depth++;
+
+			return done ();
+		}
+
+		bool done () {
+			return level->count == 0;
+		}
+
+		long get_num_states () {
+			return num_states;
+		}
+
+		int get_depth () {
+			return depth;
+		}
+
+		int get_goal_distance () {
+			return goal_distance;
+		}
+
+		// A new state is lost if all its bits happen to be set already
+		double get_collision_probability () {
+			double fill = (double)num_bits_set / ((double)bit_mask + 1);
+			return pow (fill, NUM_HASHES);
+		}
+	};
+
+	Explorer *get_bitstate_explorer (int log2_bits, int num_inputs) {
+		if (log2_bits > BitstateExplorer::MAX_LOG2_BITS) {
+			printf ("The bitstate explorer takes at most 2^%d bits\n", BitstateExplorer::MAX_LOG2_BITS);
+			return NULL;
+		}
+		BitstateExplorer *explorer = new BitstateExplorer (num_inputs);
+		if (!explorer->allocate_bits (log2_bits)) {
+			printf ("Out of memory allocating 2^%d bits for the bitstate explorer\n", log2_bits);
+			delete explorer;
+			return NULL;
+		}
+		return explorer;
+	}
+
+} // namespace Cass
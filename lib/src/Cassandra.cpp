@@ -3,7 +3,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory.h>
-#include "Cassandra.h"
+#include <float.h>
+#include <limits.h>
+#include <algorithm>
+#include <chrono>
+#include "GraphSolver.h"
 
 #ifdef _WIN32
 #include <crtdbg.h>
@@ -15,290 +19,961 @@
 #endif  // _DEBUG
 #endif
 
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch (addr)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define PREFETCH(addr) _mm_prefetch ((const char *)(addr), _MM_HINT_T0)
+#else
+#define PREFETCH(addr)
+#endif
+
 namespace Cass {
 
-	// A StateNode wraps a game State and adds pointers to possible other states,
+	// A StateNode wraps a game State and adds the possible transitions to other nodes,
 	// linked lists, and other non-game info.
 	struct StateNode {
-		static const int MAX_STEPS = 1000000;
-		static int NUM_TRANSITIONS;
-
 		// Nodes where the player can go from here.
-		// Array of NUM_TRANSITION StateNode*.
+		// Array of num_transitions node indices, NO_NODE where the transition is not possible.
 		// If NULL, this StateNode has not been processed yet (so it should be in the
-		// incomplete_list).
-		StateNode **transitions;
+		// frontier).
+		int *transitions;
 		// Game state we are wrapping
 		State *state;
 		// Other StateNodes in this same hash bucket
-		StateNode *next_in_hash_bucket;
-		// Other StateNodes in the incomplete list.
-		StateNode *next_in_incomplete_list;
-		// Distance to a given node. Depends on the calculation currently being performed.
-		int steps;
-		// Progress state. Used for some renderers (display only nodes which go somewhere, for example)
-		State::Progress progress;
-
-		// StateNode takes ownership of the state
-		StateNode (State *state) : state (state), transitions (NULL),
-			next_in_hash_bucket (NULL), next_in_incomplete_list (NULL), steps (0) {
-			progress = State::IN_PROCESS;
-		}
-
-		~StateNode () {
-			delete state;
-			if (transitions)
-				delete[] transitions;
-		}
-
-		// Recursively calculate the Progress of all StateNodes connected to this one
-		State::Progress calc_view_state (int new_steps) {
-			// This node has already been processed
-			if (steps <= new_steps)
-				return State::DEAD_END;
-
-			steps = new_steps;
-
-			if (!transitions)
-				return State::IN_PROCESS;
-
-			progress = State::DEAD_END;
-			for (int i = 0; i < NUM_TRANSITIONS; i++) {
-				StateNode *target = transitions[i];
-				if (target) {
-					State::Progress prog = target->calc_view_state (new_steps + 1);
-					if (prog != State::DEAD_END) {
-						progress = State::IN_PROCESS;
-					}
-				}
-			}
+		int next_in_hash_bucket;
+		// Length of the shortest path found from the starting point
+		int depth;
+	};
 
-			// Regardless of anything else
-			if (state->has_won ())
-				return State::IN_PROCESS;
+	// FIFO of node indices, stored in a ring buffer which grows as needed
+	class NodeQueue {
+	private:
+		int *buffer;
+		// Always a power of two
+		int capacity;
+		int head;
+		int size;
 
-			return progress;
+	public:
+		NodeQueue () : capacity (1024), head (0), size (0) {
+			buffer = allocate_array<int> (capacity, MEMORY_FRONTIER);
 		}
 
-		// Return the minimum number of steps required to reach the goal
-		// Or MAX_STEPS if goal unreachable or not found yet.
-		int find_minimum_goal_distance (int new_steps) const {
-			// This node has already been processed
-			if (steps <= new_steps || !transitions)
-				return MAX_STEPS;
+		~NodeQueue () {
+			release_array (buffer, capacity, MEMORY_FRONTIER);
+		}
 
-			if (state->has_won ()) {
-				return new_steps;
-			}
+		int get_size () const {
+			return size;
+		}
 
-			int min_dist = MAX_STEPS;
-			for (int i = 0; i < NUM_TRANSITIONS; i++) {
-				StateNode *target = transitions[i];
-				if (target) {
-					int dist = target->find_minimum_goal_distance (new_steps + 1);
-					if (dist < min_dist) {
-						min_dist = dist;
-					}
-				}
+		// The i-th node waiting in the queue (0 is the next one to come out)
+		int peek (int i) const {
+			return buffer[(head + i) & (capacity - 1)];
+		}
+
+		void push (int node) {
+			if (size == capacity) {
+				// Unwrap into a buffer twice as big
+				int *new_buffer = allocate_array<int> (2 * capacity, MEMORY_FRONTIER);
+				for (int i = 0; i < size; i++)
+					new_buffer[i] = peek (i);
+				release_array (buffer, capacity, MEMORY_FRONTIER);
+				buffer = new_buffer;
+				capacity *= 2;
+				head = 0;
 			}
-			return min_dist;;
+			buffer[(head + size) & (capacity - 1)] = node;
+			size++;
 		}
 
-		// Mark the GOAL Progress of all StateNodes in the path to the Goal
-		bool calc_goal_path (int new_steps, int min_steps) {
-			// This node has already been processed
-			if (steps <= new_steps || !transitions)
-				return false;
+		void clear () {
+			head = 0;
+			size = 0;
+		}
 
-			if (state->has_won () && steps == min_steps) {
-				// Back track to mark GOAL nodes
-				progress = State::GOAL;
-				return true;
-			}
+		// Take up to max_nodes nodes out of the queue. Returns how many were taken.
+		int pop (int *nodes, int max_nodes) {
+			int count = max_nodes < size ? max_nodes : size;
+			for (int i = 0; i < count; i++)
+				nodes[i] = peek (i);
+			skip (count);
+			return count;
+		}
 
-			for (int i = 0; i < NUM_TRANSITIONS; i++) {
-				StateNode *target = transitions[i];
-				if (target) {
-					if (target->calc_goal_path (new_steps + 1, min_steps)) {
-						progress = State::GOAL;
-						return true;
-					}
-				}
-			}
-			return false;
+		// Drop the next count nodes, which must be waiting
+		void skip (int count) {
+			head = (head + count) & (capacity - 1);
+			size -= count;
+		}
+	};
+
+	// Priority queue of node indices for best-first exploration, in a binary heap which
+	// grows as needed. Nodes come out by lowest priority, the deepest first among equals.
+	class NodeHeap {
+	public:
+		struct Entry {
+			int priority;
+			// Depth of the node when it was pushed, it may be pushed again if a shorter
+			// path to it is found
+			int depth;
+			int node;
+		};
+
+	private:
+		Entry *entries;
+		int capacity;
+		int size;
+
+		static bool comes_before (const Entry &a, const Entry &b) {
+			if (a.priority != b.priority)
+				return a.priority < b.priority;
+			if (a.depth != b.depth)
+				return a.depth > b.depth;
+			return a.node < b.node;
 		}
 
-		// Recursively render all states at distance max_steps from the current state
-		void render_ghosts (int steps, int max_steps, const StateNode *current) {
-			if (steps > this->steps)
-				return;
+	public:
+		NodeHeap () : capacity (1024), size (0) {
+			entries = allocate_array<Entry> (capacity, MEMORY_FRONTIER);
+		}
 
-			if (steps == max_steps) {
-				state->render_ghosts (progress, current->state);
-				return;
+		~NodeHeap () {
+			release_array (entries, capacity, MEMORY_FRONTIER);
+		}
+
+		int get_size () const {
+			return size;
+		}
+
+		void push (int node, int depth, int priority) {
+			if (size == capacity) {
+				entries = reallocate_array (entries, capacity, 2 * capacity, MEMORY_FRONTIER);
+				capacity *= 2;
+			}
+			Entry entry = { priority, depth, node };
+			int i = size++;
+			while (i > 0 && comes_before (entry, entries[(i - 1) / 2])) {
+				entries[i] = entries[(i - 1) / 2];
+				i = (i - 1) / 2;
 			}
+			entries[i] = entry;
+		}
 
-			if (!transitions)
-				return;
+		void clear () {
+			size = 0;
+		}
 
-			for (int i = 0; i < NUM_TRANSITIONS; i++) {
-				StateNode *target = transitions[i];
-				if (target) {
-					target->render_ghosts (steps + 1, max_steps, current);
-				}
+		// Take the first entry out of the heap, which must not be empty
+		Entry pop () {
+			Entry first = entries[0];
+			Entry last = entries[--size];
+			int i = 0;
+			while (2 * i + 1 < size) {
+				int child = 2 * i + 1;
+				if (child + 1 < size && comes_before (entries[child + 1], entries[child]))
+					child++;
+				if (!comes_before (entries[child], last))
+					break;
+				entries[i] = entries[child];
+				i = child;
 			}
+			entries[i] = last;
+			return first;
 		}
 	};
 
-	int StateNode::NUM_TRANSITIONS;
-
 	// This class incrementally builds a map of ALL possible game movements (states).
 	// It can also mark states with a Progress value (interesting or not interesting, for example)
 	// and once a goal is reached, it can mark the path to the goal too.
 	// It can also render all states.
-	class FullSolver : public Solver {
+	class FullSolver : public GraphSolver {
 	private:
+		// How many frontier nodes are expanded together by process ()
+		static const int PROCESS_BATCH = 32;
+		// Nodes expanded by process_for () between checks of the deadline. Expanding a node
+		// means creating and looking up all its children, which can take as long as
+		// reading the clock many times.
+		static const int PROCESS_SLICE_NODES = 32;
+		// An eviction keeps the nodes which fit in this part of the memory budget. The
+		// rest is room to explore until the next one.
+		static const int EVICT_TARGET_PERCENT = 75;
+		// Nodes in dead ends are evicted as if they were this many times farther
+		static const int DEAD_END_FACTOR = 4;
+
+		// What an eviction left of a node whose children were forgotten. Stubs are not in
+		// the frontier until the player gets close (see wake_stubs ()).
+		enum StubKind {
+			NOT_STUB,
+			OPEN_STUB,       // It might lead somewhere, its transitions are unknown
+			DEAD_END_STUB    // It led nowhere, it looks like a node without transitions
+		};
+
 		// Size of the hash table (set by app)
 		int num_hash_buckets;
-		// Number of possible transitions out of any node (set by app)
-		int num_transitions;
 		// Hash table that stores all processed nodes for quick comparison
-		StateNode **node_hash;
-		// Incomplete nodes list that stores nodes waiting to be processed
-		StateNode *incomplete_head;
-		StateNode *incomplete_tail;
-		// Node the player is currently in
-		StateNode *current_node;
+		int *node_hash;
+		// All known nodes, in the order they were found. The starting point comes first.
+		// Evicted nodes leave a free slot (with no state) for later ones.
+		StateNode *nodes;
+		int num_nodes;
+		int max_nodes;
+		int num_expanded;
+		// Nodes in the frontier, waiting to be expanded
+		int num_waiting;
+		// Nodes ever added, evicted or not
+		int num_found;
+		// Incomplete nodes waiting to be processed, in the order they were found
+		NodeQueue frontier;
+		// Used instead of the frontier when exploring best-first, with the weight of
+		// State::heuristic () in the priority of the nodes. 0 for breadth-first.
+		NodeHeap best_first;
+		int heuristic_weight;
+		// Woken stubs and the new nodes they lead to near the player, expanded before the
+		// frontier. urgent_steps says for how many more steps their children stay urgent.
+		NodeQueue urgent;
+		NodeQueue urgent_steps;
+		// Nodes being expanded, and their children (PROCESS_BATCH * num_transitions) with their hashes
+		int batch[PROCESS_BATCH];
+		int batch_steps[PROCESS_BATCH];
+		State **batch_children;
+		State::Hash *batch_hashes;
+		// When the current process_batch () started, for SolverStats::goal_time. Only kept
+		// with CASS_STATS.
+		double process_start;
+
+		// See set_memory_budget (), 0 for no limit
+		long long memory_budget;
+		// Memory used (see get_memory_used ()) at which the next eviction starts
+		long long evict_threshold;
+		// State::get_size () of every node and their sum, only kept with a budget
+		int *state_sizes;
+		long long state_bytes;
+		// StubKind of every node, allocated by the first eviction
+		unsigned char *stubs;
+		int num_stubs;
+		long long num_evicted;
+		// Free slots left by evicted nodes, linked through next_in_hash_bucket
+		int free_nodes;
+		// Distance from the current node up to which the last eviction kept nodes
+		int evict_cutoff;
+		// The transitions of dead end stubs, all NO_NODE
+		int *dead_end_transitions;
+		// Breadth-first search of wake_stubs (), allocated by the first one. Steps are
+		// MAX_STEPS between searches, only the nodes visited are reset.
+		int *wake_steps;
+		int *wake_queue;
 
 		// Find a state in the hash os processed states
 		// The actual comparison is performed by the app's state since
 		// we know nothing about state internals
-		StateNode *find (State *state) {
-			State::Hash hash = state->get_hash ();
-			StateNode *tmp = node_hash[hash];
-			while (tmp) {
-				if (state->equals (tmp->state)) return tmp;
-				tmp = tmp->next_in_hash_bucket;
+		int find (State *state, State::Hash hash) {
+			int tmp = node_hash[hash];
+			while (tmp != NO_NODE) {
+				CASS_STAT (stats.equals_calls++);
+				if (state->equals (nodes[tmp].state)) return tmp;
+				tmp = nodes[tmp].next_in_hash_bucket;
 			}
-			return NULL;
+			return NO_NODE;
 		}
 
-		// Clears the Process flag (view state) of all known states
-		void reset_view_state () {
-			for (int i = 0; i < num_hash_buckets; i++) {
-				StateNode *node = node_hash[i];
-				while (node) {
-					node->steps = StateNode::MAX_STEPS;
-					node->progress = State::DEAD_END;
-					node = node->next_in_hash_bucket;
-				}
-			}
+		bool is_stub (int node) const {
+			return stubs && stubs[node] != NOT_STUB;
 		}
 
-		// Create a StateNode wrapping the State, and add it both to the hash and the list
-		// of incomplete nodes.
-		StateNode *add_node (State *state) {
-			StateNode *node = new StateNode (state);
-			State::Hash hash = state->get_hash ();
-			StateNode *tmp = node_hash[hash], *prv = NULL;
-			while (tmp) {
+		void push_urgent (int node, int steps) {
+			urgent.push (node);
+			urgent_steps.push (steps);
+			num_waiting++;
+		}
+
+		void push_frontier (int node) {
+			if (heuristic_weight)
+				best_first.push (node, nodes[node].depth, nodes[node].depth + heuristic_weight * nodes[node].state->heuristic ());
+			else
+				frontier.push (node);
+			num_waiting++;
+		}
+
+		// Create a StateNode wrapping the State, and add it both to the hash and the
+		// frontier, or the urgent nodes if urgent_steps is not negative.
+		// This might move the nodes array around.
+		int add_node (State *state, State::Hash hash, int depth, int urgent_steps) {
+			int index;
+			if (free_nodes != NO_NODE) {
+				index = free_nodes;
+				free_nodes = nodes[index].next_in_hash_bucket;
+			} else {
+				if (num_nodes == max_nodes) {
+					nodes = reallocate_array (nodes, max_nodes, 2 * max_nodes, MEMORY_NODES);
+					if (state_sizes)
+						state_sizes = reallocate_array (state_sizes, max_nodes, 2 * max_nodes, MEMORY_NODES);
+					if (stubs) {
+						stubs = reallocate_array (stubs, max_nodes, 2 * max_nodes, MEMORY_NODES);
+						memset (stubs + max_nodes, NOT_STUB, max_nodes);
+					}
+					if (wake_steps) {
+						wake_steps = reallocate_array (wake_steps, max_nodes, 2 * max_nodes, MEMORY_OTHER);
+						wake_queue = reallocate_array (wake_queue, max_nodes, 2 * max_nodes, MEMORY_OTHER);
+						for (int i = max_nodes; i < 2 * max_nodes; i++)
+							wake_steps[i] = MAX_STEPS;
+					}
+					max_nodes *= 2;
+				}
+				index = num_nodes++;
+			}
+			num_found++;
+			StateNode *node = &nodes[index];
+			node->transitions = NULL;
+			node->state = state;
+			node->next_in_hash_bucket = NO_NODE;
+			node->depth = depth;
+
+			int tmp = node_hash[hash], prv = NO_NODE;
+			while (tmp != NO_NODE) {
 				prv = tmp;
-				tmp = tmp->next_in_hash_bucket;
+				tmp = nodes[tmp].next_in_hash_bucket;
 			}
-			if (!prv)
-				node_hash[hash] = node;
+			if (prv == NO_NODE)
+				node_hash[hash] = index;
 			else
-				prv->next_in_hash_bucket = node;
+				nodes[prv].next_in_hash_bucket = index;
 
-			if (!incomplete_head) {
-				incomplete_head = incomplete_tail = node;
-			} else {
-				incomplete_tail->next_in_incomplete_list = node;
-				incomplete_tail = node;
+			if (state_sizes) {
+				state_sizes[index] = state->get_size ();
+				state_bytes += state_sizes[index];
+			}
+			if (urgent_steps >= 0)
+				push_urgent (index, urgent_steps);
+			else
+				push_frontier (index);
+#ifdef CASS_STATS
+			if (stats.goal_nodes_expanded < 0 && state->has_won ()) {
+				stats.goal_nodes_expanded = stats.nodes_expanded;
+				stats.goal_time = stats.process_time + get_time () - process_start;
 			}
+#endif
+
+			return index;
+		}
+
+		// A shorter path to a node which has not been expanded yet moves it forward in
+		// the best-first order
+		void found_path (int node, int depth) {
+			if (!heuristic_weight || nodes[node].transitions || is_stub (node) || depth >= nodes[node].depth)
+				return;
+			nodes[node].depth = depth;
+			best_first.push (node, depth, depth + heuristic_weight * nodes[node].state->heuristic ());
+		}
 
-			return node;
+		// Take up to max_nodes nodes to expand into the batch, the urgent ones first
+		int pop_frontier (int max_nodes) {
+			int count = urgent.pop (batch, max_nodes);
+			urgent_steps.pop (batch_steps, count);
+			if (!heuristic_weight) {
+				int more = frontier.pop (batch + count, max_nodes - count);
+				for (int i = count; i < count + more; i++)
+					batch_steps[i] = 0;
+				count += more;
+			}
+			while (heuristic_weight && count < max_nodes && best_first.get_size () > 0) {
+				NodeHeap::Entry entry = best_first.pop ();
+				// Skip nodes pushed again through a shorter path, and the ones already expanded.
+				// An urgent node can be in the heap too, if found_path () moved it forward.
+				if (nodes[entry.node].transitions || entry.depth != nodes[entry.node].depth ||
+						std::find (batch, batch + count, entry.node) != batch + count)
+					continue;
+				batch_steps[count] = 0;
+				batch[count++] = entry.node;
+			}
+			num_waiting -= count;
+			return count;
+		}
+
+		// Memory used by the graph, as limited by the budget
+		long long get_memory_used () const {
+			return (long long)max_nodes * sizeof (StateNode) + (long long)num_hash_buckets * sizeof (int) +
+				(long long)num_expanded * num_transitions * sizeof (int) + state_bytes;
+		}
+
+		// Put the remaining nodes back in the hash and the frontier after an eviction
+		void rebuild () {
+			for (int i = 0; i < num_hash_buckets; i++)
+				node_hash[i] = NO_NODE;
+			// The urgent nodes which are still waiting stay urgent, marked in wake_steps
+			int num_urgent = urgent.get_size ();
+			for (int i = 0; i < num_urgent; i++) {
+				int node = urgent.peek (0), steps = urgent_steps.peek (0);
+				urgent.skip (1);
+				urgent_steps.skip (1);
+				if (nodes[node].state && !nodes[node].transitions && !is_stub (node)) {
+					urgent.push (node);
+					urgent_steps.push (steps);
+					wake_steps[node] = steps;
+				}
+			}
+			frontier.clear ();
+			best_first.clear ();
+			num_expanded = 0;
+			num_waiting = urgent.get_size ();
+			// Backwards, so the chains keep the order in which the nodes were found
+			for (int i = num_nodes - 1; i >= 0; i--) {
+				if (!nodes[i].state)
+					continue;
+				State::Hash hash = nodes[i].state->get_hash ();
+				nodes[i].next_in_hash_bucket = node_hash[hash];
+				node_hash[hash] = i;
+				if (nodes[i].transitions)
+					num_expanded++;
+			}
+			for (int i = 0; i < num_nodes; i++) {
+				if (!nodes[i].state || nodes[i].transitions || is_stub (i))
+					continue;
+				if (wake_steps && wake_steps[i] != MAX_STEPS)
+					wake_steps[i] = MAX_STEPS;
+				else
+					push_frontier (i);
+			}
+		}
+
+		// Make the stubs near the current node urgent, so they and the nodes they lead to
+		// within the radius are expanded before the rest of the frontier, and before the
+		// player gets there
+		void wake_stubs () {
+			int radius = evict_cutoff / 2;
+			if (radius < view_horizon + 1)
+				radius = view_horizon + 1;
+			if (!wake_steps) {
+				wake_steps = allocate_array<int> (max_nodes, MEMORY_OTHER);
+				wake_queue = allocate_array<int> (max_nodes, MEMORY_OTHER);
+				for (int i = 0; i < max_nodes; i++)
+					wake_steps[i] = MAX_STEPS;
+			}
+			wake_steps[current_node] = 0;
+			wake_queue[0] = current_node;
+			int queue_size = 1;
+			for (int q = 0; q < queue_size; q++) {
+				int node = wake_queue[q];
+				if (is_stub (node)) {
+					stubs[node] = NOT_STUB;
+					num_stubs--;
+					push_urgent (node, radius - wake_steps[node]);
+					continue;
+				}
+				const int *transitions = nodes[node].transitions;
+				for (int j = 0; transitions && wake_steps[node] < radius && j < num_transitions; j++) {
+					if (transitions[j] != NO_NODE && wake_steps[transitions[j]] == MAX_STEPS) {
+						wake_steps[transitions[j]] = wake_steps[node] + 1;
+						wake_queue[queue_size++] = transitions[j];
+					}
+				}
+			}
+			for (int q = 0; q < queue_size; q++)
+				wake_steps[wake_queue[q]] = MAX_STEPS;
+		}
+
+		// Forget the nodes farthest from the current node, so the rest fits in
+		// EVICT_TARGET_PERCENT of the budget. Nodes which cannot be reached from the current
+		// node any more always go. The children of the kept nodes which do not fit become
+		// stubs, and everything beyond them is forgotten, so the kept nodes only lead to
+		// kept nodes and stubs.
+		void evict () {
+			CASS_TRACE ("evict");
+			int *in_start = allocate_array<int> (num_nodes + 1, MEMORY_OTHER);
+			int *queue = allocate_array<int> (num_nodes, MEMORY_OTHER);
+			int *rank = allocate_array<int> (num_nodes, MEMORY_OTHER);
+			unsigned char *live = allocate_array<unsigned char> (num_nodes, MEMORY_OTHER);
+			unsigned char *keep = allocate_array<unsigned char> (num_nodes, MEMORY_OTHER);
+
+			// Reverse the transitions, as GraphSolver::condense () does, with rank keeping
+			// where the next one of each target goes
+			memset (in_start, 0, (num_nodes + 1) * sizeof (int));
+			for (int i = 0; i < num_nodes; i++) {
+				for (int j = 0; nodes[i].transitions && j < num_transitions; j++) {
+					if (nodes[i].transitions[j] != NO_NODE)
+						in_start[nodes[i].transitions[j] + 1]++;
+				}
+			}
+			for (int i = 0; i < num_nodes; i++) {
+				rank[i] = in_start[i];
+				in_start[i + 1] += in_start[i];
+			}
+			int *in_nodes = allocate_array<int> (in_start[num_nodes], MEMORY_OTHER);
+			for (int i = 0; i < num_nodes; i++) {
+				for (int j = 0; nodes[i].transitions && j < num_transitions; j++) {
+					if (nodes[i].transitions[j] != NO_NODE)
+						in_nodes[rank[nodes[i].transitions[j]]++] = i;
+				}
+			}
+
+			// Nodes which might lead somewhere: back from the goals, the nodes waiting in the
+			// frontier and the open stubs
+			int queue_size = 0;
+			for (int i = 0; i < num_nodes; i++) {
+				const StateNode *node = &nodes[i];
+				live[i] = node->state && ((!node->transitions && !(stubs && stubs[i] == DEAD_END_STUB)) || node->state->has_won ());
+				if (live[i])
+					queue[queue_size++] = i;
+			}
+			for (int q = 0; q < queue_size; q++) {
+				for (int j = in_start[queue[q]]; j < in_start[queue[q] + 1]; j++) {
+					if (!live[in_nodes[j]]) {
+						live[in_nodes[j]] = 1;
+						queue[queue_size++] = in_nodes[j];
+					}
+				}
+			}
+			release_array (in_nodes, in_start[num_nodes], MEMORY_OTHER);
+
+			// Distance from the current node, breadth-first, made DEAD_END_FACTOR times
+			// longer for dead ends. Dead ends only lead to dead ends, so the nodes up to any
+			// distance are still connected to the current node by the nodes kept with them.
+			for (int i = 0; i < num_nodes; i++)
+				rank[i] = MAX_STEPS;
+			rank[current_node] = 0;
+			queue[0] = current_node;
+			queue_size = 1;
+			for (int q = 0; q < queue_size; q++) {
+				const int *transitions = nodes[queue[q]].transitions;
+				for (int j = 0; transitions && j < num_transitions; j++) {
+					if (transitions[j] != NO_NODE && rank[transitions[j]] == MAX_STEPS) {
+						rank[transitions[j]] = rank[queue[q]] + 1;
+						queue[queue_size++] = transitions[j];
+					}
+				}
+			}
+			int max_rank = 0;
+			for (int q = 0; q < queue_size; q++) {
+				int node = queue[q];
+				if (!live[node])
+					rank[node] *= DEAD_END_FACTOR;
+				if (rank[node] > max_rank)
+					max_rank = rank[node];
+			}
+
+			// The farthest distance whose nodes fit
+			long long *rank_bytes = allocate_array<long long> (max_rank + 1, MEMORY_OTHER);
+			memset (rank_bytes, 0, (max_rank + 1) * sizeof (long long));
+			for (int q = 0; q < queue_size; q++) {
+				int node = queue[q];
+				rank_bytes[rank[node]] += state_sizes[node] + (nodes[node].transitions ? num_transitions * sizeof (int) : 0);
+			}
+			long long fixed = (long long)max_nodes * sizeof (StateNode) + (long long)num_hash_buckets * sizeof (int);
+			long long available = memory_budget / 100 * EVICT_TARGET_PERCENT - fixed;
+			int cutoff = 0;
+			for (long long total = rank_bytes[0]; cutoff < max_rank && total + rank_bytes[cutoff + 1] <= available; cutoff++)
+				total += rank_bytes[cutoff + 1];
+			release_array (rank_bytes, max_rank + 1, MEMORY_OTHER);
+
+			// keep is now 1 for the nodes within the cutoff and 2 for the stubs
+			for (int i = 0; i < num_nodes; i++)
+				keep[i] = rank[i] <= cutoff;
+			for (int i = 0; i < num_nodes; i++) {
+				for (int j = 0; keep[i] == 1 && nodes[i].transitions && j < num_transitions; j++) {
+					int target = nodes[i].transitions[j];
+					if (target != NO_NODE && !keep[target])
+						keep[target] = 2;
+				}
+			}
+
+			if (!stubs) {
+				stubs = allocate_array<unsigned char> (max_nodes, MEMORY_NODES);
+				memset (stubs, NOT_STUB, max_nodes);
+			}
+			for (int i = num_nodes - 1; i >= 0; i--) {
+				StateNode *node = &nodes[i];
+				if (!node->state || keep[i] == 1)
+					continue;
+				if (node->transitions) {
+					release_array (node->transitions, num_transitions, MEMORY_TRANSITIONS);
+					node->transitions = NULL;
+					num_expanded--;
+				}
+				if (keep[i] == 2) {
+					if (stubs[i] == NOT_STUB) {
+						stubs[i] = live[i] ? OPEN_STUB : DEAD_END_STUB;
+						num_stubs++;
+					}
+					continue;
+				}
+				delete node->state;
+				node->state = NULL;
+				state_bytes -= state_sizes[i];
+				if (stubs[i] != NOT_STUB) {
+					stubs[i] = NOT_STUB;
+					num_stubs--;
+				}
+				node->next_in_hash_bucket = free_nodes;
+				free_nodes = i;
+				num_evicted++;
+			}
+			release_array (in_start, num_nodes + 1, MEMORY_OTHER);
+			release_array (queue, num_nodes, MEMORY_OTHER);
+			release_array (rank, num_nodes, MEMORY_OTHER);
+			release_array (live, num_nodes, MEMORY_OTHER);
+			release_array (keep, num_nodes, MEMORY_OTHER);
+			evict_cutoff = cutoff;
+			rebuild ();
+
+			// Explore at least a quarter of the budget before the next one, even if not
+			// everything kept fits
+			evict_threshold = get_memory_used () + memory_budget / 4;
+			if (evict_threshold < memory_budget)
+				evict_threshold = memory_budget;
+			discard_view_state ();
+		}
+
+	protected:
+
+		const int *get_transitions (int node) {
+			if (stubs && stubs[node] == DEAD_END_STUB)
+				return dead_end_transitions;
+			return nodes[node].transitions;
+		}
+
+		bool has_won (int node) {
+			// Free slots have no state
+			return nodes[node].state && nodes[node].state->has_won ();
+		}
+
+		State *get_state (int node) {
+			return nodes[node].state;
 		}
 
 	public:
-		FullSolver (int num_hash_buckets, int num_transitions) :
-				num_hash_buckets (num_hash_buckets), num_transitions (num_transitions),
-				incomplete_head (NULL), incomplete_tail (NULL), current_node (NULL) {
-			node_hash = new StateNode*[num_hash_buckets];
-			memset (node_hash, 0, num_hash_buckets * sizeof (StateNode *));
+		int get_num_nodes () {
+			return num_nodes;
+		}
+
+		FullSolver (int num_hash_buckets, int num_transitions, int heuristic_weight) : GraphSolver (num_transitions),
+				num_hash_buckets (num_hash_buckets), num_nodes (0), max_nodes (1024), num_expanded (0),
+				num_waiting (0), num_found (0), heuristic_weight (heuristic_weight), process_start (0),
+				memory_budget (0), evict_threshold (0), state_sizes (NULL), state_bytes (0), stubs (NULL),
+				num_stubs (0), num_evicted (0), free_nodes (NO_NODE), evict_cutoff (0), wake_steps (NULL),
+				wake_queue (NULL) {
+			node_hash = allocate_array<int> (num_hash_buckets, MEMORY_HASH);
+			for (int i = 0; i < num_hash_buckets; i++)
+				node_hash[i] = NO_NODE;
+			nodes = allocate_array<StateNode> (max_nodes, MEMORY_NODES);
+			batch_children = allocate_array<State *> (PROCESS_BATCH * num_transitions, MEMORY_OTHER);
+			batch_hashes = allocate_array<State::Hash> (PROCESS_BATCH * num_transitions, MEMORY_OTHER);
+			dead_end_transitions = allocate_array<int> (num_transitions, MEMORY_TRANSITIONS);
+			for (int i = 0; i < num_transitions; i++)
+				dead_end_transitions[i] = NO_NODE;
+			CASS_STAT (stats.goal_nodes_expanded = -1);
 		}
 
 		~FullSolver () {
-			for (int i = 0; i < num_hash_buckets; i++) {
-				StateNode *node = node_hash[i];
-				while (node) {
-					StateNode *tmp = node;
-					node = node->next_in_hash_bucket;
-					delete tmp;
-				}
+			for (int i = 0; i < num_nodes; i++) {
+				delete nodes[i].state;
+				release_array (nodes[i].transitions, num_transitions, MEMORY_TRANSITIONS);
 			}
-			delete[] node_hash;
+			release_array (nodes, max_nodes, MEMORY_NODES);
+			release_array (node_hash, num_hash_buckets, MEMORY_HASH);
+			release_array (batch_children, PROCESS_BATCH * num_transitions, MEMORY_OTHER);
+			release_array (batch_hashes, PROCESS_BATCH * num_transitions, MEMORY_OTHER);
+			release_array (dead_end_transitions, num_transitions, MEMORY_TRANSITIONS);
+			release_array (state_sizes, max_nodes, MEMORY_NODES);
+			release_array (stubs, max_nodes, MEMORY_NODES);
+			release_array (wake_steps, max_nodes, MEMORY_OTHER);
+			release_array (wake_queue, max_nodes, MEMORY_OTHER);
 		}
 
 		void add_start_point (State *state) {
-			current_node = add_node (state->clone ());
+			State *start = state->clone ();
+			current_node = add_node (start, start->get_hash (), 0, -1);
+			graph_version++;
+		}
+
+		// Process a batch of up to max_nodes (at most PROCESS_BATCH) nodes from the
+		// frontier, and add more nodes to it if necessary. Returns the size of the batch.
+		// Looking up a child is a chain of cache misses (hash bucket, node, state), so
+		// all children in the batch are generated first, then their buckets are
+		// prefetched, and only then are they looked up, in the same order as if nodes
+		// were processed one by one.
+		int expand_batch (int max_nodes) {
+			int batch_size = pop_frontier (max_nodes < PROCESS_BATCH ? max_nodes : PROCESS_BATCH);
+			if (!batch_size)
+				return 0;
+
+			for (int b = 0; b < batch_size; b++) {
+				PREFETCH (&nodes[batch[b]]);
+			}
+			for (int b = 0; b < batch_size; b++) {
+				const State *state = nodes[batch[b]].state;
+				for (int i = 0; i < num_transitions; i++) {
+					State *child = state->get_transition (i);
+					batch_children[b * num_transitions + i] = child;
+					if (child) {
+						CASS_STAT (stats.children_generated++);
+						batch_hashes[b * num_transitions + i] = child->get_hash ();
+						PREFETCH (&node_hash[batch_hashes[b * num_transitions + i]]);
+					}
+				}
+			}
+			for (int c = 0; c < batch_size * num_transitions; c++) {
+				if (batch_children[c] && node_hash[batch_hashes[c]] != NO_NODE) {
+					const StateNode *first = &nodes[node_hash[batch_hashes[c]]];
+					PREFETCH (first);
+					PREFETCH (first->state);
+				}
+			}
+
+			for (int b = 0; b < batch_size; b++) {
+				CASS_STAT (stats.nodes_expanded++);
+				int depth = nodes[batch[b]].depth + 1;
+				int *transitions = allocate_array<int> (num_transitions, MEMORY_TRANSITIONS);
+				for (int i = 0; i < num_transitions; i++) {
+					State *target_state = batch_children[b * num_transitions + i];
+					State::Hash hash = batch_hashes[b * num_transitions + i];
+					transitions[i] = NO_NODE;
+					if (!target_state)
+						continue;
+
+					int other_target = find (target_state, hash);
+					if (other_target != NO_NODE) {
+						CASS_STAT (stats.duplicates++);
+						delete target_state;
+						transitions[i] = other_target;
+						found_path (other_target, depth);
+					} else {
+						transitions[i] = add_node (target_state, hash, depth, batch_steps[b] > 0 ? batch_steps[b] - 1 : -1);
+					}
+				}
+				nodes[batch[b]].transitions = transitions;
+			}
+			num_expanded += batch_size;
+			return batch_size;
 		}
 
-		// Process the node at the head of the incomplete nodes list, and add
-		// More nodes to the tail if necessary.
 		bool process () {
-			StateNode *node = incomplete_head;
-			node->transitions = new StateNode*[num_transitions];
-			memset (node->transitions, 0, num_transitions * sizeof (StateNode*));
-			for (int i = 0; i < num_transitions; i++) {
-				State *target_state = node->state->get_transition (i);
-				if (!target_state)
-					continue;
+			process_batch (PROCESS_BATCH, NULL);
+			return done ();
+		}
 
-				StateNode *other_target = find (target_state);
-				if (other_target) {
-					delete target_state;
-					node->transitions[i] = other_target;
-				} else {
-					node->transitions[i] = add_node (target_state);
+		// Process up to max_nodes nodes, or until the deadline if there is one. All of them
+		// share the bookkeeping: one timer, one trace event and one new graph version.
+		int process_until (int max_nodes, double deadline, int *added) {
+			int processed = 0, old_num_found = num_found;
+			if (!done () && max_nodes > 0 && (deadline == DBL_MAX || get_time () < deadline)) {
+				CASS_STAT_TIMER (&stats.process_time);
+				CASS_STAT (process_start = get_time ());
+				CASS_TRACE ("process");
+				int next_check = PROCESS_SLICE_NODES;
+				while (processed < max_nodes && !done ()) {
+					processed += expand_batch (max_nodes - processed);
+					if (memory_budget && get_memory_used () > evict_threshold)
+						evict ();
+					if (processed >= next_check && deadline != DBL_MAX) {
+						if (get_time () >= deadline)
+							break;
+						next_check = processed + PROCESS_SLICE_NODES;
+					}
 				}
+				graph_version++;
 			}
+			if (added)
+				*added = num_found - old_num_found;
+			return processed;
+		}
 
-			incomplete_head = incomplete_head->next_in_incomplete_list;
-			node->next_in_incomplete_list = NULL;
+		int process_batch (int max_nodes, int *added) {
+			return process_until (max_nodes, DBL_MAX, added);
+		}
 
-			return done ();
+		int process_for (double deadline, int *added) {
+			return process_until (INT_MAX, deadline, added);
 		}
 
+		// Stubs do not count, they are only expanded again when the player gets close
 		bool done () {
-			return incomplete_head == NULL;
+			return num_waiting == 0;
 		}
 
-		void update (int input) {
-			// FIXME When this transition has not been calculated yet
-			if (current_node->transitions) {
-				current_node = current_node->transitions[input];
-			} else {
-				printf ("Unprocessed transition!\n");
+		void set_memory_budget (long long bytes) {
+			memory_budget = bytes > 0 ? bytes : 0;
+			evict_threshold = memory_budget;
+			if (memory_budget && !state_sizes) {
+				state_sizes = allocate_array<int> (max_nodes, MEMORY_NODES);
+				for (int i = 0; i < num_nodes; i++) {
+					state_sizes[i] = nodes[i].state ? nodes[i].state->get_size () : 0;
+					state_bytes += state_sizes[i];
+				}
 			}
 		}
 
-		void calc_view_state () {
-			reset_view_state ();
-			current_node->calc_view_state (0);
-			int dist = current_node->find_minimum_goal_distance (0);
-			current_node->calc_goal_path (0, dist);
+		bool has_evicted () {
+			return num_evicted > 0;
+		}
+
+		void update (int input) {
+			GraphSolver::update (input);
+			if (num_stubs > 0)
+				wake_stubs ();
 		}
 
-		void render (int distance) {
-			current_node->render_ghosts (0, distance, current_node);
+		SolverStats get_stats () {
+			SolverStats result = stats;
+
+			result.num_hash_buckets = num_hash_buckets;
+			for (int i = 0; i < num_hash_buckets; i++) {
+				int length = 0;
+				for (int node = node_hash[i]; node != NO_NODE; node = nodes[node].next_in_hash_bucket)
+					length++;
+				result.chain_histogram[length < SolverStats::CHAIN_HISTOGRAM_SIZE ? length : SolverStats::CHAIN_HISTOGRAM_SIZE - 1]++;
+				if (length > result.longest_chain)
+					result.longest_chain = length;
+			}
+
+			result.frontier_size = num_waiting;
+			result.stub_nodes = num_stubs;
+			result.evicted_nodes = num_evicted;
+			result.node_bytes = (long long)max_nodes * sizeof (StateNode) + (long long)num_hash_buckets * sizeof (int);
+			result.transition_bytes = (long long)num_expanded * num_transitions * sizeof (int);
+			result.goal_depth = -1;
+			for (int i = 0; i < num_nodes; i++) {
+				if (!nodes[i].state)
+					continue;
+				result.state_bytes += nodes[i].state->get_size ();
+				if (nodes[i].depth > result.max_depth)
+					result.max_depth = nodes[i].depth;
+				if ((result.goal_depth < 0 || nodes[i].depth < result.goal_depth) && nodes[i].state->has_won ())
+					result.goal_depth = nodes[i].depth;
+			}
+			return result;
+		}
+
+		bool save (const char *filename, unsigned int level_checksum) {
+			if (!done ())
+				return false;
+			if (num_evicted || num_stubs) {
+				printf ("Part of the graph was evicted, it cannot be saved\n");
+				return false;
+			}
+
+			// Pack all states first, to know their offsets. The graph is complete by now, so
+			// running out of memory for these buffers fails the save instead of aborting.
+			size_t offsets_size = ((size_t)num_nodes + 1) * sizeof (long long);
+			long long *state_offsets = (long long *)try_allocate_zeroed (offsets_size, MEMORY_OTHER);
+			long long states_size = 0, states_capacity = 64 * 1024;
+			unsigned char *states = (unsigned char *)try_allocate_zeroed ((size_t)states_capacity, MEMORY_OTHER);
+			bool ok = state_offsets && states;
+			if (!ok)
+				printf ("Not enough memory to save %s\n", filename);
+			for (int i = 0; i < num_nodes && ok; i++) {
+				int size;
+				state_offsets[i] = states_size;
+				while ((size = nodes[i].state->pack (states + states_size, (int)(states_capacity - states_size))) > states_capacity - states_size) {
+					unsigned char *bigger = (unsigned char *)try_reallocate (states, (size_t)states_capacity,
+						(size_t)states_capacity * 2, MEMORY_OTHER);
+					if (!bigger)
+						break;
+					states = bigger;
+					states_capacity *= 2;
+				}
+				if (size < 0) {
+					printf ("States do not support packing!\n");
+					ok = false;
+				} else if (size > states_capacity - states_size) {
+					printf ("Not enough memory to save %s\n", filename);
+					ok = false;
+				} else {
+					states_size += size;
+				}
+			}
+
+			if (!ok) {
+				release (state_offsets, offsets_size, MEMORY_OTHER);
+				release (states, (size_t)states_capacity, MEMORY_OTHER);
+				return false;
+			}
+			state_offsets[num_nodes] = states_size;
+
+			int num_components = condense_graph ();
+
+			FILE *f = fopen (filename, "wb");
+			if (!f) {
+				printf ("Could not create %s\n", filename);
+				release (state_offsets, offsets_size, MEMORY_OTHER);
+				release (states, (size_t)states_capacity, MEMORY_OTHER);
+				return false;
+			}
+
+			SavedGraphHeader header;
+			memset (&header, 0, sizeof (header));
+			memcpy (header.magic, SAVED_GRAPH_MAGIC, sizeof (header.magic));
+			header.version = SAVED_GRAPH_VERSION;
+			header.level_checksum = level_checksum;
+			header.num_transitions = num_transitions;
+			header.num_nodes = num_nodes;
+			header.num_components = num_components;
+			header.states_size = states_size;
+			ok = fwrite (&header, sizeof (header), 1, f) == 1;
+
+			for (int i = 0; i < num_nodes && ok; i++)
+				ok = fwrite (nodes[i].transitions, sizeof (int), num_transitions, f) == (size_t)num_transitions;
+			if (((long long)num_nodes * num_transitions) % 2) {
+				int padding = 0;
+				ok = ok && fwrite (&padding, sizeof (int), 1, f) == 1;
+			}
+
+			size_t won_size = (size_t)get_won_flags_size (num_nodes);
+			unsigned char *won = (unsigned char *)try_allocate_zeroed (won_size, MEMORY_OTHER);
+			if (!won) {
+				printf ("Not enough memory to save %s\n", filename);
+				ok = false;
+			}
+			for (int i = 0; i < num_nodes && won; i++)
+				won[i] = nodes[i].state->has_won () ? 1 : 0;
+			ok = ok && fwrite (won, 1, won_size, f) == won_size;
+			release (won, won_size, MEMORY_OTHER);
+			ok = ok && write_condensation (f);
+
+			ok = ok && fwrite (state_offsets, sizeof (long long), num_nodes + 1, f) == (size_t)num_nodes + 1;
+			ok = ok && fwrite (states, 1, (size_t)states_size, f) == (size_t)states_size;
+			ok = (fclose (f) == 0) && ok;
+
+			release (state_offsets, offsets_size, MEMORY_OTHER);
+			release (states, (size_t)states_capacity, MEMORY_OTHER);
+			if (!ok) {
+				printf ("Could not write %s\n", filename);
+				remove (filename);
+			}
+			return ok;
 		}
 	};
 
 
 	Solver *get_full_solver (int num_hash_buckets, int num_transitions) {
-		StateNode::NUM_TRANSITIONS = num_transitions;
-		return new FullSolver (num_hash_buckets, num_transitions);
+		return new FullSolver (num_hash_buckets, num_transitions, 0);
+	}
+
+	Solver *get_best_first_solver (int num_hash_buckets, int num_transitions, int heuristic_weight) {
+		return new FullSolver (num_hash_buckets, num_transitions, heuristic_weight > 0 ? heuristic_weight : 1);
+	}
+
+	double get_time () {
+		std::chrono::duration<double> time = std::chrono::steady_clock::now ().time_since_epoch ();
+		return time.count ();
+	}
+
+	// FNV-1a hash of the whole file
+	unsigned int get_file_checksum (const char *filename) {
+		FILE *f = fopen (filename, "rb");
+		if (!f)
+			return 0;
+		unsigned int checksum = 2166136261u;
+		unsigned char buffer[4096];
+		size_t len;
+		while ((len = fread (buffer, 1, sizeof (buffer), f)) > 0) {
+			for (size_t i = 0; i < len; i++) {
+				checksum ^= buffer[i];
+				checksum *= 16777619u;
+			}
+		}
+		fclose (f);
+		return checksum;
 	}
 
 } // namespace Cass
\ No newline at end of file
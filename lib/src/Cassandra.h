@@ -1,6 +1,8 @@
 #ifndef __CASSANDRA_H__
 #define __CASSANDRA_H__
 
+#include <stddef.h>
+
 namespace Cass {
 	// Applications must implement this interface for their states.
 	class State {
@@ -28,6 +30,54 @@ namespace Cass {
 		virtual bool has_won () const = 0;
 		// Render this state given its progress and the current (present) state
 		virtual void render_ghosts (Progress progress, const State *current) = 0;
+
+		// Packed representation, only needed by solvers which keep states out of memory.
+		// Two states must be equal if and only if their packed representations are
+		// byte-by-byte identical. Returns the number of bytes needed; if this is larger
+		// than buffer_size nothing has been written. Returns -1 if not supported.
+		virtual int pack (unsigned char *buffer, int buffer_size) const { return -1; }
+		// Build a new state from a representation obtained with pack (). Any state of
+		// the same game can be used to call this.
+		virtual State *unpack (const unsigned char *buffer, int size) const { return 0; }
+
+		// Approximate number of bytes used by this state, only for statistics. 0 if unknown.
+		virtual int get_size () const { return 0; }
+
+		// Estimated number of moves from this state to a goal, only needed by solvers which
+		// explore best-first (see get_best_first_solver ()). 0 if unknown.
+		virtual int heuristic () const { return 0; }
+	};
+
+	// What a solver has done so far, see Solver::get_stats (). The counters are kept while
+	// exploring only if the library is built with CASS_STATS (configure --disable-stats
+	// leaves it out), and are 0 otherwise. The rest is measured by get_stats ().
+	struct SolverStats {
+		static const int CHAIN_HISTOGRAM_SIZE = 8;
+
+		// Counters
+		long long nodes_expanded;      // Nodes whose transitions were calculated
+		long long children_generated;  // States returned by State::get_transition ()
+		long long duplicates;          // Children which were already known
+		long long equals_calls;        // Calls to State::equals ()
+		long long goal_nodes_expanded; // Nodes expanded until the first goal was found, -1 if none was
+		double goal_time;              // Seconds spent in process () until then
+		double process_time;           // Seconds spent in process ()
+		double view_time;              // Seconds spent calculating view states
+
+		// Hash table
+		int num_hash_buckets;
+		// Number of buckets holding i nodes. The last one counts longer chains too.
+		int chain_histogram[CHAIN_HISTOGRAM_SIZE];
+		int longest_chain;
+
+		int max_depth;                 // Distance from the starting point to the farthest node
+		int goal_depth;                // Shortest path found to a goal, -1 if none. Exact breadth-first.
+		int frontier_size;             // Nodes waiting to be processed
+		int stub_nodes;                // Nodes left unexpanded by evictions, see Solver::set_memory_budget ()
+		long long evicted_nodes;       // Nodes forgotten by evictions
+		long long node_bytes;          // Nodes and hash table
+		long long transition_bytes;    // Transitions of the processed nodes
+		long long state_bytes;         // Game states (see State::get_size ())
 	};
 
 	// Applications use this to obtain solutions.
@@ -39,19 +89,237 @@ namespace Cass {
 
 		// Add the starting point
 		virtual void add_start_point (State *state) = 0;
-		// Process one more state. Call again if it returns false.
+		// Process a few more states. Call again if it returns false.
 		virtual bool process () = 0;
+		// Process up to max_nodes more states, fewer if calculation finishes. Returns how
+		// many were processed, and sets *added (if not NULL) to how many new ones were found.
+		virtual int process_batch (int max_nodes, int *added) = 0;
+		// Same, but until get_time () reaches the deadline. The time is only checked every
+		// few hundred states, so it may go a little past the deadline.
+		virtual int process_for (double deadline, int *added) = 0;
 		// Call this to know if calculation has finished
 		virtual bool done () = 0;
+		// Number of states found so far
+		virtual int get_num_nodes () = 0;
 		// Change the current state
 		virtual void update (int input) = 0;
 		// Calculate the progress of all currently known nodes
 		virtual void calc_view_state () = 0;
+		// Same, but stop when get_time () reaches the deadline and go on in the next call.
+		// render () keeps using the last complete view state until the new one is ready.
+		// Returns true when the view state is up to date with the current state and the
+		// nodes known when the calculation started.
+		virtual bool calc_view_state (double deadline) = 0;
+		// Only calculate the view state of the nodes up to this distance from the current
+		// state, so updating it after a move does not depend on the size of the graph.
+		// 0 (the default) calculates all reachable nodes.
+		virtual void set_view_horizon (int distance) = 0;
 		// Render all nodes at the given distance
 		virtual void render (int distance) = 0;
+		// Changes whenever the layers below do (a view state was completed or discarded), so
+		// renderers can keep what they built from them until then
+		virtual int get_view_version () = 0;
+		// The nodes of the last complete view state, in layers by distance from the current
+		// state. Each node is only in one layer, and layers are in a fixed order, so
+		// renderers can batch them.
+		virtual int get_num_layers () = 0;
+		// Number of nodes at this distance, 0 if there are none
+		virtual int get_layer_size (int distance) = 0;
+		// Game state of one of the nodes at this distance (index from 0 to get_layer_size () - 1)
+		// and its Progress, if progress is not NULL. The state is still owned by the solver.
+		virtual const State *get_layer_state (int distance, int index, State::Progress *progress) = 0;
+		// Write the complete state graph to a file, so it can be loaded later with
+		// load_solver (). Only possible once done () returns true.
+		// level_checksum identifies the level, see get_file_checksum ().
+		virtual bool save (const char *filename, unsigned int level_checksum) = 0;
+		// Counters and sizes, to find out why exploring is slow. Measuring the sizes goes
+		// through all nodes.
+		virtual SolverStats get_stats () = 0;
+		// Keep the memory used by the graph under this many bytes, 0 (the default) for no
+		// limit. States are measured with State::get_size (). Near the limit, the nodes
+		// farthest from the current state are forgotten, dead ends first. The nodes left at
+		// the edge become stubs, which are explored again when the player gets close.
+		// A solver which has forgotten nodes cannot save () its graph.
+		virtual void set_memory_budget (long long bytes) = 0;
+		// Has the budget made it forget nodes yet? Cheap, unlike get_stats ().
+		virtual bool has_evicted () { return false; }
 	};
 
 	Solver *get_full_solver (int num_hash_buckets, int num_inputs);
+
+	// Same, but the frontier is explored best-first instead of breadth-first: the next
+	// state is the one with the lowest distance from the starting point plus
+	// heuristic_weight times State::heuristic (). That is A* with a weight of 1, and
+	// greedier with more, so a path to a goal is found earlier. Everything else is
+	// explored after that, so the graph is complete in the end.
+	Solver *get_best_first_solver (int num_hash_buckets, int num_inputs, int heuristic_weight);
+
+	// Get a solver for a state graph previously written with Solver::save (). The file is
+	// mapped into memory and used directly from there, and exploration is already done.
+	// Returns NULL if the file does not exist or does not match the level_checksum or the
+	// number of inputs.
+	Solver *load_solver (const char *filename, unsigned int level_checksum, int num_inputs);
+
+	// Seconds since some fixed point in time, for deadlines
+	double get_time ();
+
+	// Checksum of the contents of a file, useful to identify levels. 0 if it cannot be read.
+	unsigned int get_file_checksum (const char *filename);
+
+	// Explorers walk the whole state space without keeping the state graph, so they
+	// cannot follow the player or render ghosts. They tell how big a level is and
+	// how far its goal is. States must support pack () and unpack ().
+	// Add an initial state with add_start_point() and call process() until it
+	// returns true.
+	class Explorer {
+	public:
+		virtual ~Explorer () {};
+
+		// Add the starting point
+		virtual void add_start_point (const State *state) = 0;
+		// Process one more level of the breadth-first search. Call again if it returns false.
+		virtual bool process () = 0;
+		// Call this to know if exploration has finished
+		virtual bool done () = 0;
+		// Number of different states found so far
+		virtual long get_num_states () = 0;
+		// Distance from the starting point to the farthest states found so far
+		virtual int get_depth () = 0;
+		// Minimum number of steps to reach a goal state, or -1 if none has been found yet
+		virtual int get_goal_distance () = 0;
+		// Approximate explorers might take a new state for an already visited one, and miss
+		// part of the state space. This is the estimated probability of that happening to
+		// the next state.
+		virtual double get_collision_probability () { return 0.0; }
+		// True if exploration stopped because of an error, which was printed. done () is
+		// true then too, and the numbers only cover what was explored before.
+		virtual bool has_failed () { return false; }
+	};
+
+	// Breadth-first exploration with delayed duplicate detection on disk. Only the level
+	// being expanded is read from disk, and at most memory_budget bytes of new states
+	// are kept in memory before being spilled as a sorted run to work_dir.
+	// Returns NULL if memory_budget is under 64KB. Files which cannot be read or written
+	// stop the exploration (see Explorer::has_failed ()).
+	Explorer *get_external_explorer (const char *work_dir, int num_inputs, long memory_budget);
+
+	// Approximate breadth-first exploration which only remembers state fingerprints, in a
+	// Bloom filter of 2^log2_bits bits. Only the current and next levels are stored, packed.
+	// Some states may be missed (see get_collision_probability ()). Returns NULL if
+	// log2_bits is more than 36 (8GB) or the bits cannot be allocated.
+	Explorer *get_bitstate_explorer (int log2_bits, int num_inputs);
+
+	// Memory accounting. The library allocates its nodes, transitions, tables and buffers
+	// through allocate () and release (), with a tag saying what the memory is for, and
+	// applications can tag their own allocations too. Bytes and allocations are counted
+	// per tag.
+	enum MemoryTag {
+		MEMORY_NODES,         // Solver nodes
+		MEMORY_HASH,          // Solver hash tables
+		MEMORY_TRANSITIONS,   // Transitions of the processed nodes
+		MEMORY_FRONTIER,      // Nodes waiting to be processed
+		MEMORY_VIEW,          // View states
+		MEMORY_CONDENSE,      // Strongly connected components and distances to the goal
+		MEMORY_EXPLORER,      // Levels and buffers of the explorers
+		MEMORY_TRACE,         // Trace buffers
+		MEMORY_OTHER,
+		NUM_MEMORY_TAGS       // Tags from add_memory_tag () come after these
+	};
+
+	static const int MAX_MEMORY_TAGS = 32;
+
+	// Where the memory comes from, malloc () and friends by default. The sizes and tags are
+	// passed on, so pools or arenas can be plugged in. release () is only called with
+	// memory from the same allocator.
+	struct Allocator {
+		void *(*allocate) (size_t size, int tag);
+		void *(*reallocate) (void *p, size_t old_size, size_t size, int tag);
+		void (*release) (void *p, size_t size, int tag);
+	};
+
+	// Change the allocator, or go back to the default one with NULL. This must be done
+	// before anything is allocated.
+	void set_allocator (const Allocator *allocator);
+
+	// Add a tag for application memory. Returns -1 if there are MAX_MEMORY_TAGS already.
+	int add_memory_tag (const char *name);
+
+	// Allocations must be released with the same size and tag. Releasing NULL does
+	// nothing. Allocating never returns NULL, it aborts if there is no memory left.
+	void *allocate (size_t size, int tag);
+	// Filled with zeros. The default allocator gets them from calloc (), so big arrays only
+	// take memory where they are written.
+	void *allocate_zeroed (size_t size, int tag);
+	// Same, but returns NULL if there is no memory left, for buffers so big that the
+	// caller should report it
+	void *try_allocate_zeroed (size_t size, int tag);
+	void *reallocate (void *p, size_t old_size, size_t size, int tag);
+	// Same, but returns NULL if there is no memory left, and p is still valid then
+	void *try_reallocate (void *p, size_t old_size, size_t size, int tag);
+	void release (void *p, size_t size, int tag);
+
+	// Uninitialized arrays of plain types
+	template <class T> T *allocate_array (long long count, int tag) {
+		return (T *)allocate ((size_t)count * sizeof (T), tag);
+	}
+
+	template <class T> T *reallocate_array (T *array, long long old_count, long long count, int tag) {
+		return (T *)reallocate (array, (size_t)old_count * sizeof (T), (size_t)count * sizeof (T), tag);
+	}
+
+	template <class T> void release_array (T *array, long long count, int tag) {
+		release (array, (size_t)count * sizeof (T), tag);
+	}
+
+	struct MemoryStats {
+		const char *name;
+		long long bytes;              // In use now
+		long long peak_bytes;         // Most ever in use at once
+		long long allocations;        // In use now
+		long long total_allocations;  // Ever made
+	};
+
+	// Tags are numbered from 0 to get_num_memory_tags () - 1
+	int get_num_memory_tags ();
+	MemoryStats get_memory_stats (int tag);
+	// Print a line per tag with any memory allocated so far
+	void print_memory_stats ();
+
+	// Tracing, to see where the time goes in a trace viewer (chrome://tracing or
+	// ui.perfetto.dev). CASS_TRACE (name) records the time until the end of its scope.
+	// Every thread keeps its last TRACE_BUFFER_EVENTS events in a ring buffer of its own,
+	// so recording takes no lock. While tracing is stopped, a scope only checks a flag.
+	static const int TRACE_BUFFER_EVENTS = 65536;
+
+	void start_tracing ();
+	void stop_tracing ();
+	bool is_tracing ();
+	// Write the events kept so far as Chrome trace JSON. Events which other threads are
+	// recording meanwhile may be left out. Returns false on errors.
+	bool write_trace (const char *filename);
+	// Name of the calling thread in traces
+	void set_trace_thread_name (const char *name);
+	// Record an event which started at start (see get_time ()) and lasted duration
+	// seconds. Only the pointer to the name is kept, so it must be a string literal or
+	// last as long.
+	void add_trace_event (const char *name, double start, double duration);
+
+	class TraceScope {
+		const char *name;
+		double start;
+
+	public:
+		TraceScope (const char *name) : name (name), start (is_tracing () ? get_time () : -1) {}
+
+		~TraceScope () {
+			if (start >= 0)
+				add_trace_event (name, start, get_time () - start);
+		}
+	};
+
+#define CASS_TRACE_NAME2(line) trace_scope_##line
+#define CASS_TRACE_NAME(line) CASS_TRACE_NAME2 (line)
+#define CASS_TRACE(name) Cass::TraceScope CASS_TRACE_NAME (__LINE__) (name)
 }
 
 #endif
\ No newline at end of file
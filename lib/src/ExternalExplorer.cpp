@@ -0,0 +1,425 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Cassandra.h"
+
+namespace Cass {
+
+	// Packed states are stored as records: an int with the size followed by the
+	// packed bytes. Records are sorted by size first and then by contents, which is
+	// all we need for duplicate detection.
+	static int get_record_size (const unsigned char *record) {
+		int size;
+		memcpy (&size, record, sizeof (int));
+		return size;
+	}
+
+	static int compare_records (const unsigned char *a, const unsigned char *b) {
+		int size_a = get_record_size (a);
+		int size_b = get_record_size (b);
+		if (size_a != size_b)
+			return size_a < size_b ? -1 : 1;
+		return memcmp (a + sizeof (int), b + sizeof (int), size_a);
+	}
+
+	static int compare_record_ptrs (const void *a, const void *b) {
+		return compare_records (*(const unsigned char **)a, *(const unsigned char **)b);
+	}
+
+	// Sequential reader of a file of sorted records
+	struct RunReader {
+		FILE *f;
+		unsigned char *record;
+		int capacity;
+		bool valid;
+
+		RunReader () : f (NULL), record (NULL), capacity (0), valid (false) {}
+
+		~RunReader () {
+			close ();
+			release (record, capacity, MEMORY_EXPLORER);
+		}
+
+		bool open (const char *filename) {
+			f = fopen (filename, "rb");
+			if (!f)
+				return false;
+			next ();
+			return true;
+		}
+
+		void close () {
+			if (f)
+				fclose (f);
+			f = NULL;
+			valid = false;
+		}
+
+		// Advance to the next record. valid becomes false at the end of the file.
+		void next () {
+			int size;
+			valid = false;
+			if (fread (&size, sizeof (int), 1, f) != 1)
+				return;
+			if ((int)sizeof (int) + size > capacity) {
+				int new_capacity = 2 * (sizeof (int) + size);
+				record = (unsigned char *)reallocate (record, capacity, new_capacity, MEMORY_EXPLORER);
+				capacity = new_capacity;
+			}
+			memcpy (record, &size, sizeof (int));
+			if (fread (record + sizeof (int), 1, size, f) != (size_t)size)
+				return;
+			valid = true;
+		}
+	};
+
+	static void write_record (FILE *f, const unsigned char *record) {
+		fwrite (record, 1, sizeof (int) + get_record_size (record), f);
+	}
+
+	// Close a file which was written, returns false if any write failed
+	static bool close_written (FILE *f) {
+		bool ok = !ferror (f);
+		return (fclose (f) == 0) && ok;
+	}
+
+	// Breadth-first exploration keeping everything on disk but the states generated
+	// from the current level, with delayed duplicate detection:
+	//  - All states in the current level are read from disk and expanded.
+	//  - Children are packed into a memory buffer. When it is full, it is sorted and
+	//    written to disk as a run without duplicates.
+	//  - At the end of the level all runs are merged together with the sorted list of
+	//    visited states. Children not found there form the next level, and are also
+	//    merged into a new visited list.
+	class ExternalExplorer : public Explorer {
+	private:
+		static const int MAX_RUNS = 64;
+	public:
+		// Below this, most levels would be spilled a few states at a time
+		static const long MIN_MEMORY_BUDGET = 64 * 1024;
+
+	private:
+
+		char work_dir[1024];
+		int num_inputs;
+		// Bytes of packed children kept in memory before spilling a run
+		long memory_budget;
+		// Only bigger than the budget if a single state does not fit in it
+		long buffer_size;
+		// Any state, needed to unpack the others
+		State *template_state;
+
+		// Packed children of the current level, and a sorted index into them
+		unsigned char *buffer;
+		long buffer_used;
+		unsigned char **records;
+		int num_records;
+		int max_records;
+
+		// Scratch buffer for pack ()
+		unsigned char *pack_buffer;
+		int pack_buffer_size;
+
+		int num_runs;
+		int num_files;
+		long num_states;
+		long level_size;
+		int depth;
+		int goal_distance;
+		// Set by I/O errors, which stop the exploration
+		bool failed;
+
+		// What could not be done with which file
+		void fail (const char *action, const char *filename) {
+			printf ("Could not %s %s\n", action, filename);
+			failed = true;
+		}
+
+		void get_filename (char *filename, const char *name, int index) {
+			sprintf (filename, "%s/cass-%p-%s%d.bin", work_dir, (void *)this, name, index);
+		}
+
+		void add_child (const State *state) {
+			int size;
+			while ((size = state->pack (pack_buffer, pack_buffer_size)) > pack_buffer_size) {
+				release (pack_buffer, pack_buffer_size, MEMORY_EXPLORER);
+				pack_buffer_size = 2 * size;
+				pack_buffer = (unsigned char *)allocate (pack_buffer_size, MEMORY_EXPLORER);
+			}
+			if (size < 0) {
+				printf ("States do not support packing!\n");
+				return;
+			}
+
+			if (buffer_used + (long)sizeof (int) + size > memory_budget || num_records == max_records)
+				spill_run ();
+			if ((long)sizeof (int) + size > buffer_size) {
+				// The buffer is empty after spilling
+				buffer = (unsigned char *)reallocate (buffer, buffer_size, sizeof (int) + size, MEMORY_EXPLORER);
+				buffer_size = sizeof (int) + size;
+			}
+
+			unsigned char *record = buffer + buffer_used;
+			memcpy (record, &size, sizeof (int));
+			memcpy (record + sizeof (int), pack_buffer, size);
+			buffer_used += sizeof (int) + size;
+			records[num_records++] = record;
+		}
+
+		// Sort the children in memory and write them without duplicates as a new run
+		void spill_run () {
+			char filename[1100];
+
+			if (num_records == 0)
+				return;
+			if (num_runs == MAX_RUNS)
+				merge_runs ();
+
+			qsort (records, num_records, sizeof (unsigned char *), compare_record_ptrs);
+			get_filename (filename, "run", num_runs++);
+			FILE *f = fopen (filename, "wb");
+			if (f) {
+				for (int i = 0; i < num_records; i++) {
+					if (i > 0 && compare_records (records[i - 1], records[i]) == 0)
+						continue;
+					write_record (f, records[i]);
+				}
+				if (!close_written (f))
+					fail ("write", filename);
+			} else {
+				fail ("create", filename);
+			}
+
+			buffer_used = 0;
+			num_records = 0;
+		}
+
+		// Merge all runs into a sorted stream without duplicates.
+		// If visited is given, records found there are dropped, the rest are written to
+		// output and everything is written to merged_visited.
+		long merge (FILE *output, RunReader *visited, FILE *merged_visited) {
+			RunReader *runs = new RunReader[num_runs];
+			char filename[1100];
+			long written = 0;
+
+			for (int i = 0; i < num_runs; i++) {
+				get_filename (filename, "run", i);
+				if (!runs[i].open (filename))
+					fail ("open", filename);
+			}
+
+			for (;;) {
+				RunReader *min = NULL;
+				for (int i = 0; i < num_runs; i++) {
+					if (runs[i].valid && (!min || compare_records (runs[i].record, min->record) < 0))
+						min = &runs[i];
+				}
+
+				if (visited) {
+					// Copy all smaller visited states before this one
+					while (visited->valid && (!min || compare_records (visited->record, min->record) < 0)) {
+						write_record (merged_visited, visited->record);
+						visited->next ();
+					}
+				}
+				if (!min)
+					break;
+
+				bool seen = visited && visited->valid && compare_records (visited->record, min->record) == 0;
+				if (!seen) {
+					write_record (output, min->record);
+					if (merged_visited)
+						write_record (merged_visited, min->record);
+					written++;
+				}
+
+				// Skip all copies of this record in every run (each run has no duplicates)
+				for (int i = 0; i < num_runs; i++) {
+					if (&runs[i] != min && runs[i].valid && compare_records (runs[i].record, min->record) == 0)
+						runs[i].next ();
+				}
+				min->next ();
+			}
+
+			delete[] runs;
+			for (int i = 0; i < num_runs; i++) {
+				get_filename (filename, "run", i);
+				remove (filename);
+			}
+			num_runs = 0;
+			return written;
+		}
+
+		// Too many open runs: collapse them into a single one
+		void merge_runs () {
+			char filename[1100], run_filename[1100];
+			get_filename (filename, "merged", 0);
+			FILE *f = fopen (filename, "wb");
+			if (!f) {
+				// The runs are kept, the next spill fails and stops the exploration
+				fail ("create", filename);
+				return;
+			}
+			merge (f, NULL, NULL);
+			if (!close_written (f))
+				fail ("write", filename);
+			get_filename (run_filename, "run", num_runs++);
+			rename (filename, run_filename);
+		}
+
+	public:
+		ExternalExplorer (const char *work_dir, int num_inputs, long memory_budget) :
+				num_inputs (num_inputs), memory_budget (memory_budget), template_state (NULL),
+				buffer_used (0), num_records (0), pack_buffer_size (256), num_runs (0),
+				num_states (0), level_size (0), depth (0), goal_distance (-1), failed (false) {
+			strncpy (this->work_dir, work_dir, sizeof (this->work_dir) - 1);
+			this->work_dir[sizeof (this->work_dir) - 1] = '\0';
+			buffer_size = memory_budget;
+			buffer = (unsigned char *)allocate (buffer_size, MEMORY_EXPLORER);
+			// Packed states are rarely smaller than this
+			max_records = (int)(memory_budget / (sizeof (int) + 8));
+			records = allocate_array<unsigned char *> (max_records, MEMORY_EXPLORER);
+			pack_buffer = (unsigned char *)allocate (pack_buffer_size, MEMORY_EXPLORER);
+		}
+
+		~ExternalExplorer () {
+			char filename[1100];
+			get_filename (filename, "level", 0);
+			remove (filename);
+			get_filename (filename, "visited", 0);
+			remove (filename);
+			delete template_state;
+			release (buffer, buffer_size, MEMORY_EXPLORER);
+			release_array (records, max_records, MEMORY_EXPLORER);
+			release (pack_buffer, pack_buffer_size, MEMORY_EXPLORER);
+		}
+
+		void add_start_point (const State *state) {
+			char filename[1100];
+			template_state = state->clone ();
+			if (state->has_won ())
+				goal_distance = 0;
+
+			add_child (state);
+			spill_run ();
+			get_filename (filename, "level", 0);
+			FILE *level = fopen (filename, "wb");
+			get_filename (filename, "visited", 0);
+			FILE *visited = fopen (filename, "wb");
+			if (!level || !visited) {
+				fail ("create files in", work_dir);
+				if (level)
+					fclose (level);
+				if (visited)
+					fclose (visited);
+				return;
+			}
+			level_size = merge (level, NULL, visited);
+			num_states = level_size;
+			bool level_written = close_written (level);
+			bool visited_written = close_written (visited);
+			if (!level_written || !visited_written)
+				fail ("write files in", work_dir);
+		}
+
+		bool process () {
+			char level_filename[1100], visited_filename[1100], filename[1100];
+
+			if (done ())
+				return true;
+			CASS_TRACE ("explore level");
+
+			// Expand the current level
+			get_filename (level_filename, "level", 0);
+			RunReader level;
+			if (!level.open (level_filename)) {
+				fail ("open", level_filename);
+				return true;
+			}
+			while (level.valid) {
+				State *state = template_state->unpack (level.record + sizeof (int), get_record_size (level.record));
+				for (int i = 0; i < num_inputs; i++) {
+					State *child = state->get_transition (i);
+					if (!child)
+						continue;
+					if (goal_distance < 0 && child->has_won ())
+						goal_distance = depth + 1;
+					add_child (child);
+					delete child;
+				}
+				delete state;
+				level.next ();
+			}
+			level.close ();
+			spill_run ();
+			if (failed)
+				return true;
+
+			// Detect duplicates and build the next level
+			get_filename (visited_filename, "visited", 0);
+			RunReader visited;
+			if (!visited.open (visited_filename)) {
+				fail ("open", visited_filename);
+				return true;
+			}
+			get_filename (filename, "visited", 1);
+			FILE *merged_visited = fopen (filename, "wb");
+			FILE *next_level = fopen (level_filename, "wb");
+			if (!merged_visited || !next_level) {
+				fail ("create files in", work_dir);
+				if (merged_visited)
+					fclose (merged_visited);
+				if (next_level)
+					fclose (next_level);
+				return true;
+			}
+			level_size = merge (next_level, &visited, merged_visited);
+			visited.close ();
+			bool level_written = close_written (next_level);
+			bool visited_written = close_written (merged_visited);
+			if (!level_written || !visited_written || failed) {
+				if (!level_written || !visited_written)
+					fail ("write files in", work_dir);
+				return true;
+			}
+			remove (visited_filename);
+			rename (filename, visited_filename);
+
+			num_states += level_size;
+			if (level_size > 0)
+				depth++;
+
+			return done ();
+		}
+
+		bool done () {
+			return level_size == 0 || failed;
+		}
+
+		bool has_failed () {
+			return failed;
+		}
+
+		long get_num_states () {
+			return num_states;
+		}
+
+		int get_depth () {
+			return depth;
+		}
+
+		int get_goal_distance () {
+			return goal_distance;
+		}
+	};
+
+	Explorer *get_external_explorer (const char *work_dir, int num_inputs, long memory_budget) {
+		if (memory_budget < ExternalExplorer::MIN_MEMORY_BUDGET) {
+			printf ("The external explorer needs a memory budget of at least %ld bytes\n", ExternalExplorer::MIN_MEMORY_BUDGET);
+			return NULL;
+		}
+		return new ExternalExplorer (work_dir, num_inputs, memory_budget);
+	}
+
+} // namespace Cass
@@ -0,0 +1,805 @@
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+#include "GraphSolver.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Cass {
+
+	// Levels with fewer nodes than this are not worth splitting among threads
+	static const int MIN_PARALLEL_NODES = 4096;
+	// Nodes processed between checks of the deadline
+	static const int SLICE_NODES = 65536;
+
+	// Steps of GraphSolver::condense ()
+	enum CondenseStep {
+		CONDENSE_INIT,
+		CONDENSE_TARJAN,
+		CONDENSE_COUNT_IN,
+		CONDENSE_START_IN,
+		CONDENSE_FILL_IN,
+		CONDENSE_GOALS,
+		CONDENSE_GOAL_DISTANCE,
+		CONDENSE_DONE
+	};
+
+	static inline int count_bits (unsigned long long word) {
+#ifdef _MSC_VER
+		return (int)__popcnt64 (word);
+#else
+		return __builtin_popcountll (word);
+#endif
+	}
+
+	static inline int lowest_bit (unsigned long long word) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64 (&index, word);
+		return (int)index;
+#else
+		return __builtin_ctzll (word);
+#endif
+	}
+
+	// Clears the view state of some reached nodes
+	class GraphSolver::ResetTask : public ThreadPool::Task {
+	public:
+		GraphSolver::ViewState *view;
+		const int *nodes;
+
+		ResetTask (GraphSolver::ViewState *view, const int *nodes) : view (view), nodes (nodes) {}
+
+		void run (int thread, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				view->steps[nodes[i]] = MAX_STEPS;
+				view->progress[nodes[i]] = State::DEAD_END;
+			}
+		}
+	};
+
+	// Marks the children of some nodes which have not been reached yet in level_bits
+	class GraphSolver::ExpandTask : public ThreadPool::Task {
+	public:
+		GraphSolver *solver;
+		const int *nodes;
+
+		ExpandTask (GraphSolver *solver, const int *nodes) : solver (solver), nodes (nodes) {}
+
+		void run (int thread, int begin, int end) {
+			const int *steps = solver->next_view->steps;
+			for (int i = begin; i < end; i++) {
+				const int *transitions = solver->get_snapshot_transitions (nodes[i]);
+				if (!transitions)
+					continue;
+				for (int j = 0; j < solver->num_transitions; j++) {
+					int target = transitions[j];
+					if (target != NO_NODE && steps[target] == MAX_STEPS)
+						solver->level_bits[target >> 6].fetch_or (1ull << (target & 63), std::memory_order_relaxed);
+				}
+			}
+		}
+	};
+
+	// Counts the marked nodes in each range of level_bits words
+	class GraphSolver::CountTask : public ThreadPool::Task {
+	public:
+		GraphSolver *solver;
+
+		CountTask (GraphSolver *solver) : solver (solver) {}
+
+		void run (int thread, int begin, int end) {
+			int count = 0;
+			for (int i = begin; i < end; i++)
+				count += count_bits (solver->level_bits[i].load (std::memory_order_relaxed));
+			solver->thread_results[thread] = count;
+		}
+	};
+
+	// Moves the marked nodes into the next level, in index order, and clears level_bits.
+	// thread_results has the position of the first node of each range.
+	class GraphSolver::CollectTask : public ThreadPool::Task {
+	public:
+		GraphSolver *solver;
+		int next_steps;
+
+		CollectTask (GraphSolver *solver, int next_steps) : solver (solver), next_steps (next_steps) {}
+
+		void run (int thread, int begin, int end) {
+			GraphSolver::ViewState *view = solver->next_view;
+			int position = solver->thread_results[thread];
+			for (int i = begin; i < end; i++) {
+				unsigned long long word = solver->level_bits[i].load (std::memory_order_relaxed);
+				if (!word)
+					continue;
+				solver->level_bits[i].store (0, std::memory_order_relaxed);
+				while (word) {
+					int node = i * 64 + lowest_bit (word);
+					view->steps[node] = next_steps;
+					view->level_nodes[position++] = node;
+					word &= word - 1;
+				}
+			}
+		}
+	};
+
+	// Progress of some reached nodes, from their components
+	class GraphSolver::ProgressTask : public ThreadPool::Task {
+	public:
+		GraphSolver *solver;
+		const int *nodes;
+
+		ProgressTask (GraphSolver *solver, const int *nodes) : solver (solver), nodes (nodes) {}
+
+		void run (int thread, int begin, int end) {
+			State::Progress *progress = solver->next_view->progress;
+			for (int i = begin; i < end; i++)
+				progress[nodes[i]] = solver->component_progress[solver->component[nodes[i]]];
+		}
+	};
+
+	GraphSolver::GraphSolver (int num_transitions) : num_transitions (num_transitions),
+			current_node (NO_NODE), graph_version (0), view_horizon (0), view_phase (VIEW_IDLE), phase_position (0),
+			reset_reached (0), reset_old_size (0), pool (NULL),
+			level_bits (NULL), level_bits_capacity (0), condensed_version (-1), condensing_version (-1),
+			condensed_size (0), condensed_capacity (0), condensation_mapped (false), num_components (0), component (NULL),
+			component_progress (NULL), processed (NULL), tarjan_index (NULL), tarjan_low (NULL),
+			tarjan_stack (NULL), call_node (NULL), call_edge (NULL), tarjan_initialized (0),
+			tarjan_next_index (0), tarjan_stack_size (0), tarjan_depth (-1), goal_distance (NULL),
+			in_start (NULL), in_nodes (NULL), in_nodes_capacity (0), condense_step (CONDENSE_DONE),
+			goal_queue_size (0) {
+		memset (view_states, 0, sizeof (view_states));
+		memset (&stats, 0, sizeof (stats));
+		for (int i = 0; i < 2; i++) {
+			view_states[i].node = NO_NODE;
+			view_states[i].graph_version = -1;
+		}
+		view = &view_states[0];
+		next_view = &view_states[1];
+		view_version = 0;
+		num_thread_results = 1;
+		thread_results = new int[num_thread_results];
+	}
+
+	GraphSolver::~GraphSolver () {
+		delete pool;
+		for (int i = 0; i < 2; i++)
+			release_view_state (&view_states[i]);
+		delete[] level_bits;
+		delete[] thread_results;
+		release_condensation ();
+		release_array (in_nodes, in_nodes_capacity, MEMORY_CONDENSE);
+	}
+
+	void GraphSolver::discard_view_state () {
+		view_phase = VIEW_IDLE;
+		view->node = NO_NODE;
+		view->graph_version = -1;
+		view_version++;
+		// The next view state may have been left halfway, so all its nodes are cleared
+		next_view->num_levels = 0;
+		next_view->size = 0;
+		for (int i = 0; i < (level_bits_capacity + 63) / 64; i++)
+			level_bits[i].store (0, std::memory_order_relaxed);
+		condensed_version = -1;
+		graph_version++;
+	}
+
+	void GraphSolver::release_view_state (ViewState *v) {
+		release_array (v->steps, v->capacity, MEMORY_VIEW);
+		release_array (v->progress, v->capacity, MEMORY_VIEW);
+		release_array (v->level_nodes, v->capacity, MEMORY_VIEW);
+		release_array (v->level_start, v->level_start_capacity, MEMORY_VIEW);
+	}
+
+	void GraphSolver::release_condensation () {
+		if (!condensation_mapped) {
+			release_array (component, condensed_capacity, MEMORY_CONDENSE);
+			release_array (goal_distance, condensed_capacity, MEMORY_CONDENSE);
+		}
+		condensation_mapped = false;
+		release_array (component_progress, condensed_capacity, MEMORY_CONDENSE);
+		release_array (processed, condensed_capacity, MEMORY_CONDENSE);
+		release_array (tarjan_index, condensed_capacity, MEMORY_CONDENSE);
+		release_array (tarjan_low, condensed_capacity, MEMORY_CONDENSE);
+		release_array (tarjan_stack, condensed_capacity, MEMORY_CONDENSE);
+		release_array (call_node, condensed_capacity, MEMORY_CONDENSE);
+		release_array (call_edge, condensed_capacity, MEMORY_CONDENSE);
+		release_array (in_start, condensed_capacity + 1, MEMORY_CONDENSE);
+	}
+
+	void GraphSolver::run_task (ThreadPool::Task *task, int count) {
+		if (!pool || count < MIN_PARALLEL_NODES) {
+			if (count > 0)
+				task->run (0, 0, count);
+		} else {
+			pool->run (task, count);
+		}
+	}
+
+	void GraphSolver::start_condense () {
+		condensing_version = graph_version;
+		condensed_size = get_num_nodes ();
+		// A condensation read from a file has none of the arrays needed to calculate one,
+		// and its components and goal distances are in the read-only file
+		if (condensed_size > condensed_capacity || condensation_mapped) {
+			release_condensation ();
+			condensed_capacity = 2 * condensed_size;
+			component = allocate_array<int> (condensed_capacity, MEMORY_CONDENSE);
+			component_progress = allocate_array<State::Progress> (condensed_capacity, MEMORY_CONDENSE);
+			processed = allocate_array<unsigned char> (condensed_capacity, MEMORY_CONDENSE);
+			tarjan_index = allocate_array<int> (condensed_capacity, MEMORY_CONDENSE);
+			tarjan_low = allocate_array<int> (condensed_capacity, MEMORY_CONDENSE);
+			tarjan_stack = allocate_array<int> (condensed_capacity, MEMORY_CONDENSE);
+			call_node = allocate_array<int> (condensed_capacity, MEMORY_CONDENSE);
+			call_edge = allocate_array<int> (condensed_capacity, MEMORY_CONDENSE);
+			goal_distance = allocate_array<int> (condensed_capacity, MEMORY_CONDENSE);
+			in_start = allocate_array<int> (condensed_capacity + 1, MEMORY_CONDENSE);
+		}
+		condense_step = CONDENSE_INIT;
+		num_components = 0;
+		tarjan_initialized = 0;
+		tarjan_next_index = 1;
+		tarjan_stack_size = 0;
+		tarjan_depth = -1;
+		goal_queue_size = 0;
+		phase_position = 0;
+	}
+
+	void GraphSolver::tarjan_visit (int node) {
+		const int *transitions = get_transitions (node);
+		bool is_processed = transitions != NULL;
+		for (int j = 0; is_processed && j < num_transitions; j++) {
+			if (transitions[j] >= condensed_size)
+				is_processed = false;
+		}
+		processed[node] = is_processed;
+
+		tarjan_index[node] = tarjan_low[node] = tarjan_next_index++;
+		tarjan_stack[tarjan_stack_size++] = node;
+		tarjan_depth++;
+		call_node[tarjan_depth] = node;
+		call_edge[tarjan_depth] = 0;
+	}
+
+	bool GraphSolver::condense (double deadline) {
+		CASS_TRACE ("condense");
+		if (condense_step == CONDENSE_INIT) {
+			// A node is on the Tarjan stack while it has been visited (index != 0) but has no component yet
+			while (tarjan_initialized < condensed_size) {
+				int end = std::min (tarjan_initialized + SLICE_NODES, condensed_size);
+				for (int i = tarjan_initialized; i < end; i++) {
+					tarjan_index[i] = 0;
+					component[i] = NO_NODE;
+					goal_distance[i] = MAX_STEPS;
+					in_start[i + 1] = 0;
+				}
+				tarjan_initialized = end;
+				if (get_time () >= deadline)
+					return false;
+			}
+			in_start[0] = 0;
+			condense_step = CONDENSE_TARJAN;
+		}
+
+		// Depth-first search with an explicit call stack, graphs are too deep for recursion
+		int work = 0;
+		while (condense_step == CONDENSE_TARJAN) {
+			if (++work == SLICE_NODES) {
+				work = 0;
+				if (get_time () >= deadline)
+					return false;
+			}
+
+			if (tarjan_depth < 0) {
+				while (phase_position < condensed_size && tarjan_index[phase_position])
+					phase_position++;
+				if (phase_position == condensed_size) {
+					condense_step = CONDENSE_COUNT_IN;
+					phase_position = 0;
+					break;
+				}
+				tarjan_visit (phase_position);
+			}
+
+			int node = call_node[tarjan_depth];
+			const int *transitions = get_snapshot_transitions (node);
+			if (transitions && call_edge[tarjan_depth] < num_transitions) {
+				int target = transitions[call_edge[tarjan_depth]++];
+				if (target == NO_NODE)
+					continue;
+				if (!tarjan_index[target])
+					tarjan_visit (target);
+				else if (component[target] == NO_NODE && tarjan_index[target] < tarjan_low[node])
+					tarjan_low[node] = tarjan_index[target];
+				continue;
+			}
+
+			if (tarjan_low[node] == tarjan_index[node]) {
+				// New component. All components reachable from it are complete, so
+				// its Progress is known: it might lead somewhere if one of its nodes
+				// has not been processed or is a goal, or if it leads to another
+				// component which might lead somewhere.
+				int c = num_components++;
+				int first = tarjan_stack_size;
+				int member;
+				do {
+					member = tarjan_stack[--first];
+					component[member] = c;
+				} while (member != node);
+
+				State::Progress prog = State::DEAD_END;
+				for (int i = first; i < tarjan_stack_size && prog == State::DEAD_END; i++) {
+					member = tarjan_stack[i];
+					const int *member_transitions = get_snapshot_transitions (member);
+					if (!member_transitions || has_won (member)) {
+						prog = State::IN_PROCESS;
+						break;
+					}
+					for (int j = 0; j < num_transitions; j++) {
+						int target = member_transitions[j];
+						if (target != NO_NODE && component[target] != c &&
+								component_progress[component[target]] != State::DEAD_END) {
+							prog = State::IN_PROCESS;
+							break;
+						}
+					}
+				}
+				component_progress[c] = prog;
+				tarjan_stack_size = first;
+			}
+
+			tarjan_depth--;
+			if (tarjan_depth >= 0) {
+				int parent = call_node[tarjan_depth];
+				if (tarjan_low[node] < tarjan_low[parent])
+					tarjan_low[parent] = tarjan_low[node];
+			}
+		}
+
+		// Reverse the transitions: count them per target, find where the ones of each
+		// target start (tarjan_low is no longer needed and keeps where the next one goes),
+		// and put them in place
+		while (condense_step == CONDENSE_COUNT_IN) {
+			int end = std::min (phase_position + SLICE_NODES, condensed_size);
+			for (int i = phase_position; i < end; i++) {
+				const int *transitions = get_snapshot_transitions (i);
+				if (!transitions)
+					continue;
+				for (int j = 0; j < num_transitions; j++) {
+					if (transitions[j] != NO_NODE)
+						in_start[transitions[j] + 1]++;
+				}
+			}
+			phase_position = end;
+			if (phase_position == condensed_size) {
+				condense_step = CONDENSE_START_IN;
+				phase_position = 0;
+			}
+			if (get_time () >= deadline)
+				return false;
+		}
+		while (condense_step == CONDENSE_START_IN) {
+			int end = std::min (phase_position + SLICE_NODES, condensed_size);
+			for (int i = phase_position; i < end; i++) {
+				tarjan_low[i] = in_start[i];
+				in_start[i + 1] += in_start[i];
+			}
+			phase_position = end;
+			if (phase_position == condensed_size) {
+				if (in_start[condensed_size] > in_nodes_capacity) {
+					release_array (in_nodes, in_nodes_capacity, MEMORY_CONDENSE);
+					in_nodes_capacity = 2 * (long long)in_start[condensed_size];
+					in_nodes = allocate_array<int> (in_nodes_capacity, MEMORY_CONDENSE);
+				}
+				condense_step = CONDENSE_FILL_IN;
+				phase_position = 0;
+			}
+			if (get_time () >= deadline)
+				return false;
+		}
+		while (condense_step == CONDENSE_FILL_IN) {
+			int end = std::min (phase_position + SLICE_NODES, condensed_size);
+			for (int i = phase_position; i < end; i++) {
+				const int *transitions = get_snapshot_transitions (i);
+				if (!transitions)
+					continue;
+				for (int j = 0; j < num_transitions; j++) {
+					if (transitions[j] != NO_NODE)
+						in_nodes[tarjan_low[transitions[j]]++] = i;
+				}
+			}
+			phase_position = end;
+			if (phase_position == condensed_size) {
+				condense_step = CONDENSE_GOALS;
+				phase_position = 0;
+			}
+			if (get_time () >= deadline)
+				return false;
+		}
+
+		// Breadth-first search back from all goals, with tarjan_stack as the queue
+		while (condense_step == CONDENSE_GOALS) {
+			int end = std::min (phase_position + SLICE_NODES, condensed_size);
+			for (int i = phase_position; i < end; i++) {
+				if (has_won (i)) {
+					goal_distance[i] = 0;
+					tarjan_stack[goal_queue_size++] = i;
+				}
+			}
+			phase_position = end;
+			if (phase_position == condensed_size) {
+				condense_step = CONDENSE_GOAL_DISTANCE;
+				phase_position = 0;
+			}
+			if (get_time () >= deadline)
+				return false;
+		}
+		while (condense_step == CONDENSE_GOAL_DISTANCE) {
+			int end = std::min (phase_position + SLICE_NODES, goal_queue_size);
+			for (int i = phase_position; i < end; i++) {
+				int node = tarjan_stack[i];
+				for (int j = in_start[node]; j < in_start[node + 1]; j++) {
+					int parent = in_nodes[j];
+					if (goal_distance[parent] == MAX_STEPS) {
+						goal_distance[parent] = goal_distance[node] + 1;
+						tarjan_stack[goal_queue_size++] = parent;
+					}
+				}
+			}
+			phase_position = end;
+			if (phase_position == goal_queue_size) {
+				condense_step = CONDENSE_DONE;
+				break;
+			}
+			if (get_time () >= deadline)
+				return false;
+		}
+
+		condensed_version = condensing_version;
+		return true;
+	}
+
+	int GraphSolver::condense_graph () {
+		if (view_phase == VIEW_RESET) {
+			reset_view_state (DBL_MAX);
+			view_phase = VIEW_LEVELS;
+		}
+		if (view_phase == VIEW_LEVELS) {
+			calc_levels (DBL_MAX);
+			view_phase = VIEW_PROGRESS;
+		}
+		if (view_phase == VIEW_PROGRESS) {
+			calc_progress (DBL_MAX);
+			std::swap (view, next_view);
+			view_version++;
+			view_phase = VIEW_IDLE;
+		}
+		if (condensed_version != graph_version) {
+			// A condensation in progress can only be finished if the graph did not grow since
+			if (view_phase != VIEW_CONDENSE || condensing_version != graph_version)
+				start_condense ();
+			condense (DBL_MAX);
+			view_phase = VIEW_IDLE;
+		}
+		return num_components;
+	}
+
+	bool GraphSolver::write_condensation (FILE *f) {
+		int padding[2] = { 0, 0 };
+		int padding_ints = condensed_size % 2;
+		bool ok = fwrite (component, sizeof (int), condensed_size, f) == (size_t)condensed_size;
+		ok = ok && fwrite (padding, sizeof (int), padding_ints, f) == (size_t)padding_ints;
+		ok = ok && fwrite (goal_distance, sizeof (int), condensed_size, f) == (size_t)condensed_size;
+		ok = ok && fwrite (padding, sizeof (int), padding_ints, f) == (size_t)padding_ints;
+
+		size_t progress_size = (num_components + 7) & ~7;
+		unsigned char *progress = (unsigned char *)calloc (progress_size, 1);
+		for (int c = 0; c < num_components; c++)
+			progress[c] = (unsigned char)component_progress[c];
+		ok = ok && fwrite (progress, 1, progress_size, f) == progress_size;
+		free (progress);
+		return ok;
+	}
+
+	bool GraphSolver::read_condensation (int count, const unsigned char *data) {
+		int size = get_num_nodes ();
+		if (count <= 0 || count > size)
+			return false;
+		const int *saved_component = (const int *)data;
+		const int *saved_distance = (const int *)(data + (((long long)size * sizeof (int) + 7) & ~7));
+		const unsigned char *saved_progress = (const unsigned char *)saved_distance + (((long long)size * sizeof (int) + 7) & ~7);
+		for (int i = 0; i < size; i++) {
+			if (saved_component[i] < 0 || saved_component[i] >= count ||
+					saved_distance[i] < 0 || saved_distance[i] > MAX_STEPS)
+				return false;
+		}
+		for (int c = 0; c < count; c++) {
+			if (saved_progress[c] > State::GOAL)
+				return false;
+		}
+
+		release_condensation ();
+		condensed_capacity = size;
+		// Never written, condense () would get arrays of its own from start_condense ()
+		component = (int *)saved_component;
+		goal_distance = (int *)saved_distance;
+		condensation_mapped = true;
+		component_progress = allocate_array<State::Progress> (condensed_capacity, MEMORY_CONDENSE);
+		processed = allocate_array<unsigned char> (condensed_capacity, MEMORY_CONDENSE);
+		for (int c = 0; c < count; c++)
+			component_progress[c] = (State::Progress)saved_progress[c];
+		// Only finished graphs are saved
+		memset (processed, 1, size);
+
+		num_components = count;
+		condensed_size = size;
+		condense_step = CONDENSE_DONE;
+		condensing_version = condensed_version = graph_version;
+		return true;
+	}
+
+	void GraphSolver::start_view_state () {
+		ViewState *v = next_view;
+		reset_reached = v->num_levels > 0 ? v->level_start[v->num_levels] : 0;
+		reset_old_size = v->size;
+
+		if (condensed_size > v->capacity) {
+			release_array (v->steps, v->capacity, MEMORY_VIEW);
+			release_array (v->progress, v->capacity, MEMORY_VIEW);
+			release_array (v->level_nodes, v->capacity, MEMORY_VIEW);
+			v->capacity = 2 * condensed_size;
+			v->steps = allocate_array<int> (v->capacity, MEMORY_VIEW);
+			v->progress = allocate_array<State::Progress> (v->capacity, MEMORY_VIEW);
+			v->level_nodes = allocate_array<int> (v->capacity, MEMORY_VIEW);
+			reset_reached = 0;
+			reset_old_size = 0;
+		}
+		if (v->level_start_capacity < 2) {
+			v->level_start_capacity = 64;
+			v->level_start = allocate_array<int> (v->level_start_capacity, MEMORY_VIEW);
+		}
+		v->node = current_node;
+		v->size = condensed_size;
+		v->graph_version = condensed_version;
+		v->horizon = view_horizon;
+		v->num_levels = 0;
+
+		if (condensed_size > level_bits_capacity) {
+			delete[] level_bits;
+			level_bits_capacity = 2 * condensed_size;
+			int num_words = (level_bits_capacity + 63) / 64;
+			level_bits = new std::atomic<unsigned long long>[num_words];
+			for (int i = 0; i < num_words; i++)
+				level_bits[i].store (0, std::memory_order_relaxed);
+		}
+
+		if (!pool && condensed_size >= MIN_PARALLEL_NODES) {
+			pool = new ThreadPool (0);
+			delete[] thread_results;
+			num_thread_results = pool->get_num_threads ();
+			thread_results = new int[num_thread_results];
+		}
+
+		phase_position = 0;
+	}
+
+	bool GraphSolver::reset_view_state (double deadline) {
+		CASS_TRACE ("reset_view_state");
+		ViewState *v = next_view;
+
+		// Only the nodes reached last time have a view state, and the new ones none at all
+		while (phase_position < reset_reached) {
+			int count = std::min (SLICE_NODES, reset_reached - phase_position);
+			ResetTask reset (v, v->level_nodes + phase_position);
+			run_task (&reset, count);
+			phase_position += count;
+			if (get_time () >= deadline)
+				return false;
+		}
+		while (reset_old_size < v->size) {
+			int end = std::min (reset_old_size + SLICE_NODES, v->size);
+			for (int i = reset_old_size; i < end; i++) {
+				v->steps[i] = MAX_STEPS;
+				v->progress[i] = State::DEAD_END;
+			}
+			reset_old_size = end;
+			if (get_time () >= deadline)
+				return false;
+		}
+
+		v->steps[v->node] = 0;
+		v->level_nodes[0] = v->node;
+		v->level_start[0] = 0;
+		v->level_start[1] = 1;
+		v->num_levels = 1;
+		phase_position = 0;
+		return true;
+	}
+
+	bool GraphSolver::calc_levels (double deadline) {
+		CASS_TRACE ("calc_levels");
+		ViewState *v = next_view;
+
+		for (;;) {
+			// Nodes beyond the horizon are left without view state
+			if (v->horizon && v->num_levels > v->horizon)
+				return true;
+
+			int begin = v->level_start[v->num_levels - 1];
+			int end = v->level_start[v->num_levels];
+			int size = end;
+
+			if (end - begin < MIN_PARALLEL_NODES || !pool) {
+				for (int i = begin; i < end; i++) {
+					const int *transitions = get_snapshot_transitions (v->level_nodes[i]);
+					if (!transitions)
+						continue;
+					for (int j = 0; j < num_transitions; j++) {
+						int target = transitions[j];
+						if (target != NO_NODE && v->steps[target] == MAX_STEPS) {
+							v->steps[target] = v->num_levels;
+							v->level_nodes[size++] = target;
+						}
+					}
+				}
+				// Same order as the parallel version
+				std::sort (v->level_nodes + end, v->level_nodes + size);
+			} else {
+				// phase_position is the part of this level already expanded
+				while (begin + phase_position < end) {
+					int count = std::min (SLICE_NODES, end - begin - phase_position);
+					ExpandTask expand (this, v->level_nodes + begin + phase_position);
+					run_task (&expand, count);
+					phase_position += count;
+					if (begin + phase_position < end && get_time () >= deadline)
+						return false;
+				}
+
+				int num_words = (v->size + 63) / 64;
+				for (int i = 0; i < num_thread_results; i++)
+					thread_results[i] = 0;
+				CountTask count (this);
+				run_task (&count, num_words);
+				for (int i = 0; i < num_thread_results; i++) {
+					int thread_count = thread_results[i];
+					thread_results[i] = size;
+					size += thread_count;
+				}
+				CollectTask collect (this, v->num_levels);
+				run_task (&collect, num_words);
+			}
+			phase_position = 0;
+
+			if (size == end)
+				return true;
+
+			if (v->num_levels + 2 > v->level_start_capacity) {
+				v->level_start = reallocate_array (v->level_start, v->level_start_capacity, 2 * v->level_start_capacity, MEMORY_VIEW);
+				v->level_start_capacity *= 2;
+			}
+			v->num_levels++;
+			v->level_start[v->num_levels] = size;
+
+			if (get_time () >= deadline)
+				return false;
+		}
+	}
+
+	bool GraphSolver::calc_progress (double deadline) {
+		CASS_TRACE ("calc_progress");
+		ViewState *v = next_view;
+		int num_reached = v->level_start[v->num_levels];
+
+		while (phase_position < num_reached) {
+			int count = std::min (SLICE_NODES, num_reached - phase_position);
+			ProgressTask task (this, v->level_nodes + phase_position);
+			run_task (&task, count);
+			phase_position += count;
+			if (phase_position < num_reached && get_time () >= deadline)
+				return false;
+		}
+
+		mark_goal_path ();
+		return true;
+	}
+
+	void GraphSolver::mark_goal_path () {
+		ViewState *v = next_view;
+		int node = v->node;
+		if (goal_distance[node] == MAX_STEPS)
+			return;
+
+		// Each step takes the first transition one step closer to a goal
+		for (;;) {
+			v->progress[node] = State::GOAL;
+			int distance = goal_distance[node];
+			if (distance == 0)
+				return;
+
+			const int *transitions = get_snapshot_transitions (node);
+			int next = NO_NODE;
+			for (int j = 0; j < num_transitions; j++) {
+				if (transitions[j] != NO_NODE && goal_distance[transitions[j]] == distance - 1) {
+					next = transitions[j];
+					break;
+				}
+			}
+			// Beyond the horizon
+			if (v->steps[next] == MAX_STEPS)
+				return;
+			node = next;
+		}
+	}
+
+	bool GraphSolver::calc_view_state (double deadline) {
+		if (current_node == NO_NODE)
+			return true;
+		CASS_STAT_TIMER (&stats.view_time);
+		CASS_TRACE ("calc_view_state");
+
+		bool finished = false;
+		for (;;) {
+			switch (view_phase) {
+			case VIEW_IDLE:
+				if (view->node == current_node && view->graph_version == graph_version &&
+						view->horizon == view_horizon)
+					return true;
+				// Start again for the current node and graph, if there is time left
+				if (finished && get_time () >= deadline)
+					return false;
+				// The graph grew, but a condensation newer than the view can still be
+				// used, as long as it includes the current node
+				if (condensed_version != graph_version &&
+						(condensed_version == view->graph_version || current_node >= condensed_size)) {
+					start_condense ();
+					view_phase = VIEW_CONDENSE;
+				} else {
+					start_view_state ();
+					view_phase = VIEW_RESET;
+				}
+				break;
+
+			case VIEW_CONDENSE:
+				if (!condense (deadline))
+					return false;
+				view_phase = VIEW_IDLE;
+				if (current_node < condensed_size) {
+					start_view_state ();
+					view_phase = VIEW_RESET;
+				}
+				break;
+
+			case VIEW_RESET:
+				if (!reset_view_state (deadline))
+					return false;
+				view_phase = VIEW_LEVELS;
+				break;
+
+			case VIEW_LEVELS:
+				if (!calc_levels (deadline))
+					return false;
+				view_phase = VIEW_PROGRESS;
+				break;
+
+			case VIEW_PROGRESS:
+				if (!calc_progress (deadline))
+					return false;
+				// Complete, render this one from now on
+				std::swap (view, next_view);
+				view_version++;
+				view_phase = VIEW_IDLE;
+				finished = true;
+				break;
+			}
+		}
+	}
+
+	void GraphSolver::calc_view_state () {
+		calc_view_state (DBL_MAX);
+	}
+
+} // namespace Cass
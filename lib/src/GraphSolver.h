@@ -0,0 +1,305 @@
+#ifndef __GRAPHSOLVER_H__
+#define __GRAPHSOLVER_H__
+
+#include <stdio.h>
+#include <atomic>
+#include "Cassandra.h"
+#include "ThreadPool.h"
+
+namespace Cass {
+
+	// Value for transitions which cannot be taken
+	static const int NO_NODE = -1;
+
+	// Statistics kept while exploring (see SolverStats) compile to nothing without CASS_STATS
+#ifdef CASS_STATS
+#define CASS_STAT(statement) statement
+#define CASS_STAT_TIMER(total) StatTimer stat_timer (total)
+#else
+#define CASS_STAT(statement)
+#define CASS_STAT_TIMER(total)
+#endif
+
+	// Adds the time between its construction and its destruction to a total, in seconds
+	class StatTimer {
+		double *total;
+		double start;
+
+	public:
+		StatTimer (double *total) : total (total), start (get_time ()) {}
+
+		~StatTimer () {
+			*total += get_time () - start;
+		}
+	};
+
+	// Common part of the solvers which know the whole state graph. Nodes are identified
+	// by their index and only need to provide their transitions, so following the player,
+	// calculating the view state and rendering do not depend on how the graph is stored.
+	class GraphSolver : public Solver {
+	protected:
+		static const int MAX_STEPS = 1000000;
+
+		// Number of possible transitions out of any node (set by app)
+		int num_transitions;
+		// Node the player is currently in
+		int current_node;
+		// Must be incremented whenever nodes or transitions are added, so the view state
+		// is calculated again
+		int graph_version;
+		// Distance up to which the next view states are calculated, 0 for no limit
+		int view_horizon;
+
+		// View state of the nodes reachable from one node
+		struct ViewState {
+			// Node the distances are measured from
+			int node;
+			// Nodes in the graph when it was calculated, later ones have no view state
+			int size;
+			int capacity;
+			int graph_version;
+			// Maximum distance calculated, 0 for no limit
+			int horizon;
+			// Distance to node and Progress, for every node
+			int *steps;
+			State::Progress *progress;
+			// Reached nodes, by distance and then by index. The nodes at distance d
+			// are level_nodes[level_start[d]] to level_nodes[level_start[d + 1] - 1].
+			int *level_nodes;
+			int *level_start;
+			int num_levels;
+			int level_start_capacity;
+		};
+		// Last complete view state, used for rendering
+		ViewState *view;
+		// Incremented whenever view changes, see get_view_version ()
+		int view_version;
+
+		// Counters of SolverStats, the rest is filled in by get_stats ()
+		SolverStats stats;
+
+		// Array of num_transitions node indices (NO_NODE where the transition is not possible)
+		// or NULL if this node has not been processed yet.
+		virtual const int *get_transitions (int node) = 0;
+		// Is this a goal node?
+		virtual bool has_won (int node) = 0;
+		// Game state of this node. It is still owned by the solver.
+		virtual State *get_state (int node) = 0;
+
+		GraphSolver (int num_transitions);
+		~GraphSolver ();
+
+		// Must be called when nodes or transitions are removed. The view states and the
+		// condensation may refer to them, so they are calculated again from scratch, and
+		// there are no ghosts until then.
+		void discard_view_state ();
+
+		// Condense the whole graph at once, for Solver::save (), and return the number of
+		// components. A view state being calculated refers to the previous condensation,
+		// so it is finished first.
+		int condense_graph ();
+		// Write the condensation as laid out in saved graphs, after condense_graph ()
+		bool write_condensation (FILE *f);
+		// Use the condensation of a saved graph instead of calculating it. The components
+		// and goal distances are used in place, so the data must outlive the solver or the
+		// next condensation. Returns false if the data is not valid.
+		bool read_condensation (int count, const unsigned char *data);
+
+	private:
+		// The view state is calculated level by level (breadth-first), and big levels are
+		// split among the threads of the pool. Every step gives the same result regardless
+		// of how it was split, so the view state does not depend on the number of threads.
+		class ResetTask;
+		class ExpandTask;
+		class CountTask;
+		class CollectTask;
+		class ProgressTask;
+
+		// The calculation is split in phases, and big phases in slices, so it can be
+		// stopped at a deadline and resumed in the next call.
+		enum ViewPhase {
+			VIEW_IDLE,
+			VIEW_CONDENSE,
+			VIEW_RESET,
+			VIEW_LEVELS,
+			VIEW_PROGRESS
+		};
+		ViewPhase view_phase;
+		// View state being calculated, swapped with view when complete
+		ViewState *next_view;
+		ViewState view_states[2];
+		// Next item to process in the current phase
+		int phase_position;
+		// Nodes of next_view to clear: the ones reached last time and the new ones
+		int reset_reached;
+		int reset_old_size;
+
+		// Created when the graph gets big enough to need it
+		ThreadPool *pool;
+		// One bit per node, set for the nodes found for the next level
+		std::atomic<unsigned long long> *level_bits;
+		int level_bits_capacity;
+		// Results of the threads, in the order of their ranges
+		int *thread_results;
+		int num_thread_results;
+
+		// Strongly connected components of the graph, as of condensed_version. The player
+		// can go back and forth between all nodes of a component, so they all have the same
+		// Progress. Components are numbered in reverse topological order: transitions only
+		// lead to the same component or to components with lower numbers.
+		// The graph may grow while it is being condensed, so it works on a snapshot of the
+		// first condensed_size nodes. A node counts as processed if it was processed when it
+		// was first visited, and all its transitions lead to nodes in the snapshot.
+		int condensed_version;
+		int condensing_version;
+		int condensed_size;
+		int condensed_capacity;
+		// component and goal_distance point into a mapped file (see read_condensation ()),
+		// they are not released
+		bool condensation_mapped;
+		int num_components;
+		int *component;
+		State::Progress *component_progress;
+		unsigned char *processed;
+		// State of Tarjan's algorithm, kept between slices
+		int *tarjan_index;
+		int *tarjan_low;
+		int *tarjan_stack;
+		int *call_node;
+		int *call_edge;
+		int tarjan_initialized;
+		int tarjan_next_index;
+		int tarjan_stack_size;
+		int tarjan_depth;
+		// Minimum distance from every node to a goal, MAX_STEPS if there is no way to one.
+		// It does not depend on the current node either, so it is calculated with the
+		// components, by a breadth-first search back from the goals over the reversed
+		// transitions: the nodes which lead to node i are in_nodes[in_start[i]] to
+		// in_nodes[in_start[i + 1] - 1].
+		int *goal_distance;
+		int *in_start;
+		int *in_nodes;
+		long long in_nodes_capacity;
+		// Step of condense () and its progress, kept between slices
+		int condense_step;
+		int goal_queue_size;
+
+		// Transitions of a node in the condensed snapshot
+		const int *get_snapshot_transitions (int node) {
+			return processed[node] ? get_transitions (node) : NULL;
+		}
+
+		// Phases of the calculation. Each one returns true when it is finished, or false
+		// if the deadline was reached first. They always do some work before giving up.
+		void start_condense ();
+		void tarjan_visit (int node);
+		bool condense (double deadline);
+		void start_view_state ();
+		bool reset_view_state (double deadline);
+		bool calc_levels (double deadline);
+		bool calc_progress (double deadline);
+		// Mark the GOAL Progress of the reached nodes in a shortest path to a goal
+		void mark_goal_path ();
+		// Run the task on [0, count), in parallel if it is worth it
+		void run_task (ThreadPool::Task *task, int count);
+		void release_view_state (ViewState *v);
+		// Arrays of the condensation which depend on condensed_capacity
+		void release_condensation ();
+
+	public:
+		void update (int input) {
+			// FIXME When this transition has not been calculated yet
+			const int *transitions = get_transitions (current_node);
+			if (transitions) {
+				current_node = transitions[input];
+			} else {
+				printf ("Unprocessed transition!\n");
+			}
+		}
+
+		void calc_view_state ();
+		bool calc_view_state (double deadline);
+
+		void set_view_horizon (int distance) {
+			view_horizon = distance > 0 ? distance : 0;
+		}
+
+		// Each reached node is in the layer of its distance only once, so every ghost is
+		// rendered once, however many paths lead to it
+		void render (int distance) {
+			if (view->node == NO_NODE)
+				return;
+			State *current = get_state (view->node);
+			for (int i = 0; i < get_layer_size (distance); i++) {
+				int node = view->level_nodes[view->level_start[distance] + i];
+				get_state (node)->render_ghosts (view->progress[node], current);
+			}
+		}
+
+		int get_view_version () {
+			return view_version;
+		}
+
+		int get_num_layers () {
+			return view->node == NO_NODE ? 0 : view->num_levels;
+		}
+
+		int get_layer_size (int distance) {
+			if (distance < 0 || distance >= get_num_layers ())
+				return 0;
+			return view->level_start[distance + 1] - view->level_start[distance];
+		}
+
+		const State *get_layer_state (int distance, int index, State::Progress *progress) {
+			int node = view->level_nodes[view->level_start[distance] + index];
+			if (progress)
+				*progress = view->progress[node];
+			return get_state (node);
+		}
+
+		SolverStats get_stats () {
+			return stats;
+		}
+	};
+
+	// Layout of the files written by Solver::save (). All numbers are in the byte order
+	// of the machine which wrote them, and sections are 8-byte aligned so the file can be
+	// used directly from memory:
+	//  - SavedGraphHeader
+	//  - int transitions[num_nodes * num_transitions], padded to 8 bytes
+	//  - unsigned char won[num_nodes], padded to 8 bytes
+	//  - int component[num_nodes], padded to 8 bytes
+	//  - int goal_distance[num_nodes], padded to 8 bytes
+	//  - unsigned char component_progress[num_components], padded to 8 bytes
+	//  - long long state_offsets[num_nodes + 1], into the packed states
+	//  - Packed states (see State::pack ())
+	// Node 0 is the starting point. The condensation (components, their Progress and the
+	// distances to the goals) does not depend on the current node, so it is saved with the
+	// graph and need not be calculated again when it is loaded.
+	static const char SAVED_GRAPH_MAGIC[4] = { 'C', 'A', 'S', 'G' };
+	static const unsigned int SAVED_GRAPH_VERSION = 2;
+
+	struct SavedGraphHeader {
+		char magic[4];
+		unsigned int version;
+		unsigned int level_checksum;
+		int num_transitions;
+		int num_nodes;
+		int num_components;
+		long long states_size;
+	};
+
+	// Bytes taken by the won flags, including the padding
+	static inline long long get_won_flags_size (int num_nodes) {
+		return (num_nodes + 7) & ~7;
+	}
+
+	// Bytes taken by the condensation, including the padding
+	static inline long long get_condensation_size (int num_nodes, int num_components) {
+		long long node_ints = ((long long)num_nodes * sizeof (int) + 7) & ~7;
+		return 2 * node_ints + ((num_components + 7) & ~7);
+	}
+
+} // namespace Cass
+
+#endif
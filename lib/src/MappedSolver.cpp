@@ -0,0 +1,239 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "GraphSolver.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace Cass {
+
+	// A whole file mapped read-only into memory
+	struct MappedFile {
+		const unsigned char *data;
+		size_t size;
+#ifdef _WIN32
+		HANDLE file;
+		HANDLE mapping;
+#endif
+
+		MappedFile () : data (NULL), size (0) {}
+
+		~MappedFile () {
+			close ();
+		}
+
+		bool open (const char *filename) {
+#ifdef _WIN32
+			file = CreateFileA (filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER file_size;
+			GetFileSizeEx (file, &file_size);
+			size = (size_t)file_size.QuadPart;
+			mapping = CreateFileMapping (file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (!mapping) {
+				CloseHandle (file);
+				return false;
+			}
+			data = (const unsigned char *)MapViewOfFile (mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!data) {
+				CloseHandle (mapping);
+				CloseHandle (file);
+				return false;
+			}
+#else
+			int fd = ::open (filename, O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat st;
+			if (fstat (fd, &st) != 0 || st.st_size == 0) {
+				::close (fd);
+				return false;
+			}
+			size = (size_t)st.st_size;
+			void *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close (fd);
+			if (map == MAP_FAILED)
+				return false;
+			data = (const unsigned char *)map;
+#endif
+			return true;
+		}
+
+		void close () {
+			if (!data)
+				return;
+#ifdef _WIN32
+			UnmapViewOfFile (data);
+			CloseHandle (mapping);
+			CloseHandle (file);
+#else
+			munmap ((void *)data, size);
+#endif
+			data = NULL;
+		}
+	};
+
+	// Solver for a finished state graph written by Solver::save (). The graph and its
+	// condensation are checked once when the file is opened, then used straight from
+	// the mapped file. Game states are only unpacked when they need to be rendered.
+	class MappedSolver : public GraphSolver {
+	private:
+		MappedFile file;
+		const SavedGraphHeader *header;
+		const int *transitions;
+		const unsigned char *won;
+		const long long *state_offsets;
+		const unsigned char *states;
+		// Any state of this game, needed to unpack the others
+		State *template_state;
+		// States unpacked so far, per node
+		State **unpacked;
+
+	protected:
+		const int *get_transitions (int node) {
+			return transitions + (size_t)node * num_transitions;
+		}
+
+		bool has_won (int node) {
+			return won[node] != 0;
+		}
+
+		State *get_state (int node) {
+			if (!unpacked[node]) {
+				unpacked[node] = template_state->unpack (states + state_offsets[node],
+					(int)(state_offsets[node + 1] - state_offsets[node]));
+			}
+			return unpacked[node];
+		}
+
+	public:
+		MappedSolver (int num_transitions) : GraphSolver (num_transitions), header (NULL),
+				template_state (NULL), unpacked (NULL) {
+		}
+
+		~MappedSolver () {
+			if (unpacked) {
+				for (int i = 0; i < header->num_nodes; i++)
+					delete unpacked[i];
+				release_array (unpacked, header->num_nodes, MEMORY_NODES);
+			}
+			delete template_state;
+		}
+
+		// Map the file and check that it is a graph for this level
+		bool open (const char *filename, unsigned int level_checksum) {
+			if (!file.open (filename))
+				return false;
+			if (file.size < sizeof (SavedGraphHeader))
+				return false;
+			header = (const SavedGraphHeader *)file.data;
+			if (memcmp (header->magic, SAVED_GRAPH_MAGIC, sizeof (header->magic)) ||
+					header->version != SAVED_GRAPH_VERSION ||
+					header->level_checksum != level_checksum ||
+					header->num_transitions != num_transitions ||
+					header->num_nodes <= 0 ||
+					header->num_components <= 0 || header->num_components > header->num_nodes)
+				return false;
+
+			long long offset = sizeof (SavedGraphHeader);
+			transitions = (const int *)(file.data + offset);
+			offset += (long long)header->num_nodes * num_transitions * sizeof (int);
+			offset = (offset + 7) & ~7;
+			won = file.data + offset;
+			offset += get_won_flags_size (header->num_nodes);
+			const unsigned char *condensation = file.data + offset;
+			offset += get_condensation_size (header->num_nodes, header->num_components);
+			state_offsets = (const long long *)(file.data + offset);
+			offset += (header->num_nodes + 1) * sizeof (long long);
+			if ((long long)file.size < offset)
+				return false;
+			states = file.data + offset;
+			if (header->states_size < 0 || (long long)file.size - offset < header->states_size)
+				return false;
+
+			// A damaged or stale file must not send the solver out of the mapping later
+			for (long long i = 0; i < (long long)header->num_nodes * num_transitions; i++) {
+				if (transitions[i] != NO_NODE && (transitions[i] < 0 || transitions[i] >= header->num_nodes))
+					return false;
+			}
+			if (state_offsets[0] != 0 || state_offsets[header->num_nodes] > header->states_size)
+				return false;
+			for (int i = 0; i < header->num_nodes; i++) {
+				if (state_offsets[i + 1] < state_offsets[i] || state_offsets[i + 1] - state_offsets[i] > INT_MAX)
+					return false;
+			}
+			if (!read_condensation (header->num_components, condensation))
+				return false;
+
+			unpacked = allocate_array<State *> (header->num_nodes, MEMORY_NODES);
+			memset (unpacked, 0, header->num_nodes * sizeof (State *));
+			return true;
+		}
+
+		void add_start_point (State *state) {
+			template_state = state->clone ();
+			current_node = 0;
+		}
+
+		int get_num_nodes () {
+			return header->num_nodes;
+		}
+
+		bool process () {
+			return true;
+		}
+
+		int process_batch (int max_nodes, int *added) {
+			if (added)
+				*added = 0;
+			return 0;
+		}
+
+		int process_for (double deadline, int *added) {
+			return process_batch (0, added);
+		}
+
+		// The graph is mapped from the file, the system pages it in and out as needed
+		void set_memory_budget (long long bytes) {
+		}
+
+		bool done () {
+			return true;
+		}
+
+		bool save (const char *filename, unsigned int level_checksum) {
+			// Already saved
+			return false;
+		}
+
+		// Nothing is explored, the graph is in the file
+		SolverStats get_stats () {
+			SolverStats result = stats;
+			result.transition_bytes = (long long)header->num_nodes * num_transitions * sizeof (int);
+			result.state_bytes = header->states_size;
+			// Depths are not saved
+			result.goal_depth = -1;
+			return result;
+		}
+	};
+
+	Solver *load_solver (const char *filename, unsigned int level_checksum, int num_inputs) {
+		MappedSolver *solver = new MappedSolver (num_inputs);
+		if (!solver->open (filename, level_checksum)) {
+			delete solver;
+			return NULL;
+		}
+		return solver;
+	}
+
+} // namespace Cass
@@ -0,0 +1,178 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "Cassandra.h"
+
+namespace Cass {
+
+	// Counters of a tag. Allocations can happen in any thread, so they are atomic, but
+	// they are only statistics and need no ordering.
+	struct TagCounters {
+		std::atomic<long long> bytes;
+		std::atomic<long long> peak_bytes;
+		std::atomic<long long> allocations;
+		std::atomic<long long> total_allocations;
+	};
+
+	// Zero-initialized before any constructor runs, so tags can be added and memory
+	// allocated from static constructors
+	static TagCounters counters[MAX_MEMORY_TAGS];
+	static const char *tag_names[MAX_MEMORY_TAGS] = {
+		"nodes",
+		"hash",
+		"transitions",
+		"frontier",
+		"view",
+		"condense",
+		"explorer",
+		"trace",
+		"other"
+	};
+	static std::atomic<int> num_tags (NUM_MEMORY_TAGS);
+
+	static void *default_allocate (size_t size, int tag) {
+		return malloc (size);
+	}
+
+	static void *default_reallocate (void *p, size_t old_size, size_t size, int tag) {
+		return realloc (p, size);
+	}
+
+	static void default_release (void *p, size_t size, int tag) {
+		free (p);
+	}
+
+	static const Allocator default_allocator = { default_allocate, default_reallocate, default_release };
+	static Allocator allocator = default_allocator;
+
+	static void count (int tag, long long bytes, int allocations) {
+		TagCounters *c = &counters[tag];
+		long long total = c->bytes.fetch_add (bytes, std::memory_order_relaxed) + bytes;
+		long long peak = c->peak_bytes.load (std::memory_order_relaxed);
+		while (total > peak && !c->peak_bytes.compare_exchange_weak (peak, total, std::memory_order_relaxed))
+			;
+		c->allocations.fetch_add (allocations, std::memory_order_relaxed);
+		if (allocations > 0)
+			c->total_allocations.fetch_add (allocations, std::memory_order_relaxed);
+	}
+
+	void set_allocator (const Allocator *new_allocator) {
+		allocator = new_allocator ? *new_allocator : default_allocator;
+	}
+
+	int add_memory_tag (const char *name) {
+		int tag = num_tags.fetch_add (1);
+		if (tag >= MAX_MEMORY_TAGS) {
+			num_tags.store (MAX_MEMORY_TAGS);
+			printf ("Too many memory tags, %s is not counted apart\n", name);
+			return -1;
+		}
+		tag_names[tag] = name;
+		return tag;
+	}
+
+	// Tags from a failed add_memory_tag () count as MEMORY_OTHER
+	static int check_tag (int tag) {
+		return tag >= 0 && tag < MAX_MEMORY_TAGS ? tag : MEMORY_OTHER;
+	}
+
+	// Tags below MAX_MEMORY_TAGS which add_memory_tag () never returned have no name
+	static const char *get_tag_name (int tag) {
+		return tag_names[tag] ? tag_names[tag] : "untagged";
+	}
+
+	static void check_allocation (const void *p, size_t size, int tag) {
+		if (!p && size > 0) {
+			printf ("Out of memory allocating %lld bytes of %s\n", (long long)size, get_tag_name (tag));
+			abort ();
+		}
+	}
+
+	void *allocate (size_t size, int tag) {
+		tag = check_tag (tag);
+		void *p = allocator.allocate (size, tag);
+		check_allocation (p, size, tag);
+		count (tag, size, 1);
+		return p;
+	}
+
+	void *try_allocate_zeroed (size_t size, int tag) {
+		tag = check_tag (tag);
+		void *p;
+		if (allocator.allocate != default_allocate) {
+			p = allocator.allocate (size, tag);
+			if (p)
+				memset (p, 0, size);
+		} else {
+			p = calloc (size, 1);
+		}
+		if (p)
+			count (tag, size, 1);
+		return p;
+	}
+
+	void *allocate_zeroed (size_t size, int tag) {
+		void *p = try_allocate_zeroed (size, tag);
+		check_allocation (p, size, check_tag (tag));
+		return p;
+	}
+
+	void *try_reallocate (void *p, size_t old_size, size_t size, int tag) {
+		tag = check_tag (tag);
+		if (!p) {
+			p = allocator.allocate (size, tag);
+			if (p)
+				count (tag, size, 1);
+			return p;
+		}
+		void *new_p = allocator.reallocate (p, old_size, size, tag);
+		// Shrinking to nothing may free p and return NULL
+		if (new_p || size == 0)
+			count (tag, (long long)size - (long long)old_size, 0);
+		return new_p;
+	}
+
+	void *reallocate (void *p, size_t old_size, size_t size, int tag) {
+		void *new_p = try_reallocate (p, old_size, size, tag);
+		check_allocation (new_p, size, check_tag (tag));
+		return new_p;
+	}
+
+	void release (void *p, size_t size, int tag) {
+		if (!p)
+			return;
+		tag = check_tag (tag);
+		allocator.release (p, size, tag);
+		count (tag, -(long long)size, -1);
+	}
+
+	int get_num_memory_tags () {
+		int n = num_tags.load ();
+		return n < MAX_MEMORY_TAGS ? n : MAX_MEMORY_TAGS;
+	}
+
+	MemoryStats get_memory_stats (int tag) {
+		MemoryStats stats;
+		tag = check_tag (tag);
+		stats.name = get_tag_name (tag);
+		stats.bytes = counters[tag].bytes.load (std::memory_order_relaxed);
+		stats.peak_bytes = counters[tag].peak_bytes.load (std::memory_order_relaxed);
+		stats.allocations = counters[tag].allocations.load (std::memory_order_relaxed);
+		stats.total_allocations = counters[tag].total_allocations.load (std::memory_order_relaxed);
+		return stats;
+	}
+
+	void print_memory_stats () {
+		printf ("%-12s %12s %12s %12s %12s\n", "Memory", "KB", "Peak KB", "Blocks", "Total blocks");
+		for (int i = 0; i < get_num_memory_tags (); i++) {
+			MemoryStats stats = get_memory_stats (i);
+			if (!stats.total_allocations)
+				continue;
+			printf ("%-12s %12.1f %12.1f %12lld %12lld\n", stats.name, stats.bytes / 1024.0, stats.peak_bytes / 1024.0,
+				stats.allocations, stats.total_allocations);
+		}
+	}
+
+} // namespace Cass
@@ -0,0 +1,82 @@
+#include "Cassandra.h"
+#include "ThreadPool.h"
+
+namespace Cass {
+
+	ThreadPool::ThreadPool (int num_threads) : num_threads (num_threads), task (NULL), count (0),
+			generation (0), pending (0), quit (false) {
+		if (this->num_threads <= 0)
+			this->num_threads = (int)std::thread::hardware_concurrency ();
+		if (this->num_threads <= 0)
+			this->num_threads = 1;
+		// Thread 0 is the caller of run ()
+		threads = new std::thread[this->num_threads - 1];
+		for (int i = 1; i < this->num_threads; i++)
+			threads[i - 1] = std::thread (&ThreadPool::worker, this, i);
+	}
+
+	ThreadPool::~ThreadPool () {
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			quit = true;
+		}
+		start.notify_all ();
+		for (int i = 1; i < num_threads; i++)
+			threads[i - 1].join ();
+		delete[] threads;
+	}
+
+	void ThreadPool::run_range (int thread) {
+		int begin = (int)((long long)count * thread / num_threads);
+		int end = (int)((long long)count * (thread + 1) / num_threads);
+		if (begin < end) {
+			CASS_TRACE ("task");
+			task->run (thread, begin, end);
+		}
+	}
+
+	void ThreadPool::run (Task *task, int count) {
+		if (num_threads == 1) {
+			if (count > 0)
+				task->run (0, 0, count);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock (mutex);
+			this->task = task;
+			this->count = count;
+			pending = num_threads - 1;
+			generation++;
+		}
+		start.notify_all ();
+
+		run_range (0);
+
+		std::unique_lock<std::mutex> lock (mutex);
+		while (pending > 0)
+			finish.wait (lock);
+	}
+
+	void ThreadPool::worker (int thread) {
+		int last_generation = 0;
+		set_trace_thread_name ("worker");
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock (mutex);
+				while (!quit && generation == last_generation)
+					start.wait (lock);
+				if (quit)
+					return;
+				last_generation = generation;
+			}
+
+			run_range (thread);
+
+			std::lock_guard<std::mutex> lock (mutex);
+			if (--pending == 0)
+				finish.notify_one ();
+		}
+	}
+
+} // namespace Cass
@@ -0,0 +1,54 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace Cass {
+
+	// A fixed set of threads which split ranges of work among them.
+	// The thread calling run () does its share of the work too.
+	class ThreadPool {
+	public:
+		// Work to be split among the threads
+		class Task {
+		public:
+			virtual ~Task () {}
+			// Process items [begin, end). thread goes from 0 to get_num_threads () - 1.
+			virtual void run (int thread, int begin, int end) = 0;
+		};
+
+		// 0 threads means one per hardware thread
+		ThreadPool (int num_threads);
+		~ThreadPool ();
+
+		int get_num_threads () const {
+			return num_threads;
+		}
+
+		// Split [0, count) into get_num_threads () consecutive ranges, in order, run the
+		// task on all of them in parallel and wait until they are done.
+		void run (Task *task, int count);
+
+	private:
+		int num_threads;
+		std::thread *threads;
+		std::mutex mutex;
+		std::condition_variable start;
+		std::condition_variable finish;
+		// Current job
+		Task *task;
+		int count;
+		// Incremented with every job, so workers know there is a new one
+		int generation;
+		int pending;
+		bool quit;
+
+		void worker (int thread);
+		void run_range (int thread);
+	};
+
+} // namespace Cass
+
+#endif
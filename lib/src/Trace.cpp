@@ -0,0 +1,161 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include "Cassandra.h"
+
+namespace Cass {
+
+	struct TraceEvent {
+		const char *name;
+		double start;
+		double duration;
+	};
+
+	// Events of one thread. Only the thread using it writes to it: an event is filled in
+	// first and then published by incrementing count, so readers see whole events
+	// unless the ring wraps around while they read.
+	struct TraceBuffer {
+		TraceEvent events[TRACE_BUFFER_EVENTS];
+		// Events ever recorded, the last TRACE_BUFFER_EVENTS of them are kept
+		std::atomic<long long> count;
+		// Buffers of threads which have finished are used again by new threads
+		std::atomic<bool> in_use;
+		const char *thread_name;
+		int thread_id;
+		TraceBuffer *next;
+	};
+
+	static std::atomic<bool> tracing (false);
+	// Buffers are only added, at the front, and live until the program ends
+	static std::atomic<TraceBuffer *> buffers (NULL);
+	static std::atomic<int> num_buffers (0);
+	// Time of the first start_tracing (), the origin of the timestamps
+	static std::atomic<double> trace_origin (-1);
+
+	// The buffer of a thread is given back when the thread finishes
+	struct ThreadTrace {
+		TraceBuffer *buffer;
+		const char *name;
+
+		~ThreadTrace () {
+			if (buffer)
+				buffer->in_use.store (false, std::memory_order_release);
+		}
+	};
+
+	static thread_local ThreadTrace thread_trace;
+
+	static TraceBuffer *get_thread_buffer () {
+		if (thread_trace.buffer)
+			return thread_trace.buffer;
+
+		TraceBuffer *buffer;
+		for (buffer = buffers.load (std::memory_order_acquire); buffer; buffer = buffer->next) {
+			bool free_buffer = false;
+			if (buffer->in_use.compare_exchange_strong (free_buffer, true, std::memory_order_acquire))
+				break;
+		}
+		if (!buffer) {
+			buffer = (TraceBuffer *)allocate (sizeof (TraceBuffer), MEMORY_TRACE);
+			buffer->count.store (0, std::memory_order_relaxed);
+			buffer->in_use.store (true, std::memory_order_relaxed);
+			buffer->thread_id = num_buffers.fetch_add (1) + 1;
+			buffer->next = buffers.load (std::memory_order_relaxed);
+			while (!buffers.compare_exchange_weak (buffer->next, buffer, std::memory_order_release))
+				;
+		}
+		buffer->thread_name = thread_trace.name;
+		thread_trace.buffer = buffer;
+		return buffer;
+	}
+
+	void start_tracing () {
+		double origin = -1;
+		trace_origin.compare_exchange_strong (origin, get_time ());
+		tracing.store (true, std::memory_order_relaxed);
+	}
+
+	void stop_tracing () {
+		tracing.store (false, std::memory_order_relaxed);
+	}
+
+	bool is_tracing () {
+		return tracing.load (std::memory_order_relaxed);
+	}
+
+	void set_trace_thread_name (const char *name) {
+		thread_trace.name = name;
+		if (thread_trace.buffer)
+			thread_trace.buffer->thread_name = name;
+	}
+
+	void add_trace_event (const char *name, double start, double duration) {
+		TraceBuffer *buffer = get_thread_buffer ();
+		long long count = buffer->count.load (std::memory_order_relaxed);
+		TraceEvent *event = &buffer->events[count % TRACE_BUFFER_EVENTS];
+		event->name = name;
+		event->start = start;
+		event->duration = duration;
+		buffer->count.store (count + 1, std::memory_order_release);
+	}
+
+	// Names are usually literals, but they go through JSON anyway
+	static void write_json_string (FILE *f, const char *s) {
+		fputc ('"', f);
+		for (; *s; s++) {
+			if (*s == '"' || *s == '\\')
+				fputc ('\\', f);
+			if ((unsigned char)*s >= 0x20)
+				fputc (*s, f);
+		}
+		fputc ('"', f);
+	}
+
+	bool write_trace (const char *filename) {
+		FILE *f = fopen (filename, "w");
+		if (!f) {
+			printf ("Could not create %s\n", filename);
+			return false;
+		}
+
+		double origin = trace_origin.load ();
+		std::vector<TraceEvent> events;
+		bool first = true;
+		fprintf (f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		for (TraceBuffer *buffer = buffers.load (std::memory_order_acquire); buffer; buffer = buffer->next) {
+			// Copy the events, then drop the ones which may have been overwritten meanwhile
+			long long end = buffer->count.load (std::memory_order_acquire);
+			long long begin = end > TRACE_BUFFER_EVENTS ? end - TRACE_BUFFER_EVENTS : 0;
+			events.clear ();
+			for (long long i = begin; i < end; i++)
+				events.push_back (buffer->events[i % TRACE_BUFFER_EVENTS]);
+			long long overwritten = buffer->count.load (std::memory_order_acquire) - TRACE_BUFFER_EVENTS;
+			int skip = overwritten > begin ? (int)(overwritten - begin) : 0;
+
+			if (buffer->thread_name) {
+				fprintf (f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+					first ? "" : ",\n", buffer->thread_id);
+				write_json_string (f, buffer->thread_name);
+				fprintf (f, "}}");
+				first = false;
+			}
+			for (int i = skip; i < (int)events.size (); i++) {
+				fprintf (f, "%s{\"name\": ", first ? "" : ",\n");
+				write_json_string (f, events[i].name);
+				fprintf (f, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", buffer->thread_id,
+					1e6 * (events[i].start - origin), 1e6 * events[i].duration);
+				first = false;
+			}
+		}
+		fprintf (f, "\n]}\n");
+
+		if (fclose (f) != 0) {
+			printf ("Could not write %s\n", filename);
+			return false;
+		}
+		return true;
+	}
+
+} // namespace Cass
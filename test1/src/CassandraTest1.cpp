@@ -6,6 +6,7 @@
 #endif
 #include <stdio.h>
 #include <memory.h>
+#include <stddef.h>
 #include <GL/glew.h>
 #include "SDL.h"
 #include "Cassandra.h"
@@ -20,26 +21,106 @@
 
 #define CELL_WIDTH 64
 #define CELL_HEIGHT 64
+// Seconds per frame spent exploring, while there is something left to explore
+#define PROCESS_TIME 0.033
+// Seconds per frame spent calculating the view state
+#define VIEW_TIME 0.008
+// Weight of the distance to the goal when exploring, see Cass::get_best_first_solver ()
+#define HEURISTIC_WEIGHT 2
 
 extern unsigned char tiles_data[];
 int tiles_width, tiles_height;
 
 Game1::Renderer *Game1::g_renderer;
 
+// Tiles are not drawn right away, but collected in a vertex array which is drawn with a
+// single call in flush ()
 class Renderer : public Game1::Renderer {
+	struct TileVertex {
+		GLfloat x, y;
+		GLfloat u, v;
+		GLfloat r, g, b, a;
+	};
+
+	TileVertex *vertices;
+	int num_vertices;
+	int max_vertices;
+	// Streaming vertex buffer, if supported. It is deleted with the GL context.
+	GLuint vbo;
+
+	void add_vertex (int x, int y, int tilex, int tiley, float alpha) {
+		TileVertex *vertex = &vertices[num_vertices++];
+		vertex->x = (GLfloat)(x * CELL_WIDTH);
+		vertex->y = (GLfloat)(y * CELL_HEIGHT);
+		vertex->u = tilex * 32 / (GLfloat)tiles_width;
+		vertex->v = tiley * 32 / (GLfloat)tiles_height;
+		vertex->r = vertex->g = vertex->b = 1.f;
+		vertex->a = alpha;
+	}
+
 	void render_tile (int x, int y, int tilex, int tiley, float alpha) {
-		glColor4f (1.f, 1.f, 1.f, alpha);
-		glBegin (GL_TRIANGLE_STRIP);
-		for (int sx = 0; sx < 2; sx++) {
-			for (int sy = 0; sy < 2; sy++) {
-				glTexCoord2f ((tilex + sx) * 32 / (GLfloat)tiles_width, (tiley + sy) * 32 / (GLfloat)tiles_height);
-				glVertex2i ((x + sx) * CELL_WIDTH, (y + sy) * CELL_HEIGHT);
+		if (num_vertices + 6 > max_vertices) {
+			int new_max_vertices = max_vertices ? 2 * max_vertices : 6 * 1024;
+			TileVertex *new_vertices = (TileVertex *)realloc (vertices, new_max_vertices * sizeof (TileVertex));
+			if (new_vertices) {
+				vertices = new_vertices;
+				max_vertices = new_max_vertices;
+			} else {
+				// Keep the old buffer and draw what it holds to make room, tiles are still
+				// drawn in order. Without any buffer the tile is dropped.
+				flush ();
+				if (max_vertices < 6)
+					return;
 			}
 		}
-		glEnd ();
+		// The same two triangles as a strip over the four corners
+		add_vertex (x, y, tilex, tiley, alpha);
+		add_vertex (x, y + 1, tilex, tiley + 1, alpha);
+		add_vertex (x + 1, y, tilex + 1, tiley, alpha);
+		add_vertex (x + 1, y, tilex + 1, tiley, alpha);
+		add_vertex (x, y + 1, tilex, tiley + 1, alpha);
+		add_vertex (x + 1, y + 1, tilex + 1, tiley + 1, alpha);
 	}
 
 public:
+	Renderer () : vertices (NULL), num_vertices (0), max_vertices (0), vbo (0) {}
+
+	~Renderer () {
+		free (vertices);
+	}
+
+	// Draw all tiles rendered since the last flush, in order
+	void flush () {
+		if (!num_vertices)
+			return;
+
+		const char *base = (const char *)vertices;
+		if (GLEW_VERSION_1_5) {
+			if (!vbo)
+				glGenBuffers (1, &vbo);
+			glBindBuffer (GL_ARRAY_BUFFER, vbo);
+			// Orphan the last frame's buffer, so there is no need to wait until it is drawn
+			glBufferData (GL_ARRAY_BUFFER, num_vertices * sizeof (TileVertex), NULL, GL_STREAM_DRAW);
+			glBufferSubData (GL_ARRAY_BUFFER, 0, num_vertices * sizeof (TileVertex), vertices);
+			base = NULL;
+		}
+
+		glEnableClientState (GL_VERTEX_ARRAY);
+		glEnableClientState (GL_TEXTURE_COORD_ARRAY);
+		glEnableClientState (GL_COLOR_ARRAY);
+		glVertexPointer (2, GL_FLOAT, sizeof (TileVertex), base + offsetof (TileVertex, x));
+		glTexCoordPointer (2, GL_FLOAT, sizeof (TileVertex), base + offsetof (TileVertex, u));
+		glColorPointer (4, GL_FLOAT, sizeof (TileVertex), base + offsetof (TileVertex, r));
+		glDrawArrays (GL_TRIANGLES, 0, num_vertices);
+		glDisableClientState (GL_VERTEX_ARRAY);
+		glDisableClientState (GL_TEXTURE_COORD_ARRAY);
+		glDisableClientState (GL_COLOR_ARRAY);
+		if (vbo)
+			glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+		num_vertices = 0;
+	}
+
 	void renderPlayer (int x, int y, bool dead, bool won, float alpha) {
 		if (dead) render_tile (x, y, 8, 3, alpha);
 		else
@@ -59,10 +140,90 @@ public:
 	void renderGoalCell (int x, int y, float alpha)  { render_tile (x, y, 7, 5, alpha); }
 };
 
+// The solid world only changes when the player moves, so it is rendered once and copied
+// into a texture, which is drawn as a single quad in the following frames.
+class WorldCache {
+	GLuint texture;
+	int width, height;
+	// The texture is a power of two, at least width x height
+	int texture_width, texture_height;
+	bool valid;
+
+public:
+	WorldCache () : texture (0), width (0), height (0), texture_width (0), texture_height (0), valid (false) {}
+
+	// Call with the size of the window, whenever it changes. The texture is deleted with
+	// the GL context.
+	void resize (int width, int height) {
+		this->width = width;
+		this->height = height;
+		for (texture_width = 1; texture_width < width; texture_width *= 2);
+		for (texture_height = 1; texture_height < height; texture_height *= 2);
+		if (!texture)
+			glGenTextures (1, &texture);
+		glBindTexture (GL_TEXTURE_2D, texture);
+		glTexImage2D (GL_TEXTURE_2D, 0, GL_RGB, texture_width, texture_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		valid = false;
+	}
+
+	// Call when the state changes, or when the window may have lost its contents (the
+	// back buffer is undefined where the window was covered)
+	void invalidate () {
+		valid = false;
+	}
+
+	// Draw the whole world over the back buffer, rendering it again if it has changed.
+	// Leaves tiles_texture bound for the tiles drawn on top.
+	void render (Renderer *renderer, Game1::State *state, GLuint tiles_texture) {
+		if (!valid) {
+			glBindTexture (GL_TEXTURE_2D, tiles_texture);
+			glClear (GL_COLOR_BUFFER_BIT);
+			state->render (1.f);
+			renderer->flush ();
+			glBindTexture (GL_TEXTURE_2D, texture);
+			glCopyTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+			valid = true;
+		} else {
+			// Texture rows start at the bottom of the window, which is at y = height
+			GLfloat u = width / (GLfloat)texture_width, v = height / (GLfloat)texture_height;
+			glDisable (GL_BLEND);
+			glBindTexture (GL_TEXTURE_2D, texture);
+			glColor4f (1.f, 1.f, 1.f, 1.f);
+			glBegin (GL_TRIANGLE_STRIP);
+			glTexCoord2f (0.f, v);
+			glVertex2i (0, 0);
+			glTexCoord2f (0.f, 0.f);
+			glVertex2i (0, height);
+			glTexCoord2f (u, v);
+			glVertex2i (width, 0);
+			glTexCoord2f (u, 0.f);
+			glVertex2i (width, height);
+			glEnd ();
+			glEnable (GL_BLEND);
+		}
+		glBindTexture (GL_TEXTURE_2D, tiles_texture);
+	}
+};
+
+// One pixel per unit, with y going down, over the whole window
+static void set_view_size (WorldCache *world, int width, int height) {
+	glViewport (0, 0, width, height);
+	glMatrixMode (GL_PROJECTION);
+	glLoadIdentity ();
+	glOrtho (0, width, height, 0, -1, 1);
+	world->resize (width, height);
+}
+
+// Written when tracing stops (T) or the program quits while tracing
+static const char *TRACE_FILENAME = "test1-trace.json";
+
 int main (int argc, char *argv[]) {
 #ifdef _WIN32
 	_CrtSetDbgFlag (_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
+	Cass::set_trace_thread_name ("main");
 
 	if (SDL_Init (SDL_INIT_EVERYTHING) != 0) {
 		printf ("SDL Init error: %s\n", SDL_GetError ());
@@ -135,30 +296,56 @@ int main (int argc, char *argv[]) {
 
 	int max_depth = 6;
 	bool show_ghosts = true;
-	Game1::State *current_state = Game1::load_state ("../map1.txt");
-	Cass::Solver *solver = current_state->get_solver ();
+	const char *map_filename = "../map1.txt";
+	Game1::State *current_state = Game1::load_state (map_filename);
+
+	// Reuse the state graph explored in a previous run, if the level has not changed
+	char cache_filename[1024];
+	unsigned int checksum = Cass::get_file_checksum (map_filename);
+	snprintf (cache_filename, sizeof (cache_filename), "%s.cass", map_filename);
+	Cass::Solver *solver = Cass::load_solver (cache_filename, checksum, Game1::NUM_INPUTS);
+	bool saved = solver != NULL;
+	// Best-first, so the way to the goal shows up before the whole level is explored
+	if (!solver)
+		solver = current_state->get_best_first_solver (HEURISTIC_WEIGHT);
 	solver->add_start_point (current_state);
+	// Ghosts are only rendered up to max_depth steps ahead
+	solver->set_view_horizon (max_depth);
+	bool view_ready = solver->calc_view_state (Cass::get_time () + VIEW_TIME);
 
 	int win_width = CELL_WIDTH * current_state->get_map_size_x ();
 	int win_height = CELL_HEIGHT * current_state->get_map_size_y ();
 	SDL_SetWindowSize (win, win_width, win_height);
 
-	glViewport (0, 0, win_width, win_height);
-	glMatrixMode (GL_PROJECTION);
-	glOrtho (0, win_width, win_height, 0, -1, 1);
+	// Resizing is asynchronous with some window managers, the real size comes later with
+	// SDL_WINDOWEVENT_SIZE_CHANGED
+	WorldCache world;
+	set_view_size (&world, win_width, win_height);
 
 	SDL_Event e;
 	bool quit = false;
 	int anim_step = 0, anim_delay = 0;
+	// Ghosts at anim_step, built again when the current state or the solver's view state
+	// changes
+	Game1::GhostField ghosts;
+	bool ghosts_dirty = true;
+	int ghosts_distance = -1;
+	int ghosts_version = -1;
 	while (!quit) {
+		CASS_TRACE ("frame");
 		int pending = 0;
 
 		if (!solver->done ()) {
-			Uint32 last_time = SDL_GetTicks ();
-			while (!solver->done () && SDL_GetTicks () - last_time < 33) {
-				solver->process ();
+			{
+				CASS_TRACE ("process slice");
+				solver->process_for (Cass::get_time () + PROCESS_TIME, NULL);
 			}
-			solver->calc_view_state ();
+			view_ready = solver->calc_view_state (Cass::get_time () + VIEW_TIME);
+			if (solver->done () && !saved)
+				saved = solver->save (cache_filename, checksum);
+			pending = SDL_PollEvent (&e);
+		} else if (!view_ready) {
+			view_ready = solver->calc_view_state (Cass::get_time () + VIEW_TIME);
 			pending = SDL_PollEvent (&e);
 		} else {
 			pending = SDL_WaitEventTimeout (&e, 33);
@@ -170,6 +357,18 @@ int main (int argc, char *argv[]) {
 			case SDL_QUIT:
 				quit = true;
 				break;
+			case SDL_WINDOWEVENT:
+				switch (e.window.event) {
+				case SDL_WINDOWEVENT_SIZE_CHANGED:
+					set_view_size (&world, e.window.data1, e.window.data2);
+					break;
+				case SDL_WINDOWEVENT_SHOWN:
+				case SDL_WINDOWEVENT_EXPOSED:
+				case SDL_WINDOWEVENT_RESTORED:
+					world.invalidate ();
+					break;
+				}
+				break;
 			case SDL_KEYDOWN:
 				switch (e.key.keysym.sym) {
 				case SDLK_ESCAPE:
@@ -178,11 +377,25 @@ int main (int argc, char *argv[]) {
 				case SDLK_SPACE:
 					show_ghosts = !show_ghosts;
 					break;
+				case SDLK_t:
+					if (Cass::is_tracing ()) {
+						Cass::stop_tracing ();
+						if (Cass::write_trace (TRACE_FILENAME))
+							printf ("Trace written to %s\n", TRACE_FILENAME);
+					} else {
+						Cass::start_tracing ();
+						printf ("Tracing, press T again to stop\n");
+					}
+					break;
 				case SDLK_KP_PLUS:
 					max_depth++;
+					solver->set_view_horizon (max_depth);
+					view_ready = false;
 					break;
 				case SDLK_KP_MINUS:
 					max_depth = max_depth > 1 ? max_depth - 1 : max_depth;
+					solver->set_view_horizon (max_depth);
+					view_ready = false;
 					break;
 				case SDLK_UP:
 					input = Game1::UP;
@@ -206,19 +419,30 @@ int main (int argc, char *argv[]) {
 				if (current_state->can_input (input)) {
 					current_state->input (input);
 					solver->update (input);
-					solver->calc_view_state ();
+					view_ready = solver->calc_view_state (Cass::get_time () + VIEW_TIME);
+					ghosts_dirty = true;
+					world.invalidate ();
 					anim_step = 0;
 				}
 			}
 		}
 
 		// Render solid world
-		glClear (GL_COLOR_BUFFER_BIT);
-		current_state->render (1.f);
+		{
+			CASS_TRACE ("world");
+			world.render (&renderer, current_state, tiles_tex);
+		}
 
 		if (show_ghosts) {
 			// Render ghosts
-			solver->render (anim_step);
+			CASS_TRACE ("ghosts");
+			if (ghosts_dirty || ghosts_distance != anim_step || ghosts_version != solver->get_view_version ()) {
+				ghosts.build (solver, anim_step, current_state);
+				ghosts_distance = anim_step;
+				ghosts_version = solver->get_view_version ();
+				ghosts_dirty = false;
+			}
+			ghosts.render ();
 		}
 
 		anim_delay++;
@@ -229,9 +453,16 @@ int main (int argc, char *argv[]) {
 				anim_step = 0;
 		}
 
+		CASS_TRACE ("swap");
+		renderer.flush ();
 		SDL_GL_SwapWindow (win);
 	}
 
+	if (Cass::is_tracing ()) {
+		Cass::stop_tracing ();
+		Cass::write_trace (TRACE_FILENAME);
+	}
+
 	SDL_GL_DeleteContext (gl_context);
 
 	delete current_state;
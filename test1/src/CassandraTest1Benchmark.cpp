@@ -0,0 +1,380 @@
+#include "Game1.h"
+#include "Json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+
+# include <Windows.h>
+# include <psapi.h>
+
+size_t resident_memory () {
+	PROCESS_MEMORY_COUNTERS counter;
+	GetProcessMemoryInfo (GetCurrentProcess (), &counter, sizeof (counter));
+	return (size_t)counter.WorkingSetSize;
+}
+
+size_t peak_resident_memory () {
+	PROCESS_MEMORY_COUNTERS counter;
+	GetProcessMemoryInfo (GetCurrentProcess (), &counter, sizeof (counter));
+	return (size_t)counter.PeakWorkingSetSize;
+}
+
+void release_free_memory () {}
+
+#else
+
+# include <unistd.h>
+# include <sys/resource.h>
+# ifdef __GLIBC__
+#  include <malloc.h>
+# endif
+
+size_t resident_memory () {
+	size_t size = 0;
+	FILE *file = fopen ("/proc/self/statm", "r");
+	if (file) {
+		unsigned long vm = 0, resident = 0;
+		int read = fscanf (file, "%lu %lu", &vm, &resident);
+		fclose (file);
+		if (read != 2)
+			return 0;
+		size = (size_t)resident * getpagesize ();
+	}
+	return size;
+}
+
+size_t peak_resident_memory () {
+	struct rusage usage;
+	if (getrusage (RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;
+#else
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+// Give memory freed by the previous run back to the system, so it does not hide the
+// memory used by the next one
+void release_free_memory () {
+#ifdef __GLIBC__
+	malloc_trim (0);
+#endif
+}
+
+#endif
+
+Game1::Renderer *Game1::g_renderer;
+
+// Results of a benchmark, all runs of one map
+struct Result {
+	char map[1024];
+	int nodes;
+	double explore_ms;
+	double nodes_per_second;
+	long long equals_calls;
+	double bytes_per_node;
+	// Full view state from the starting point, and again after a move
+	double view_ms;
+	double move_view_ms;
+	// Peak resident size of the whole process so far, not of this map alone: the peak
+	// only grows, so it is the biggest map so far that counts
+	double process_peak_rss_mb;
+};
+
+struct Metric {
+	const char *name;
+	// Lower is better, otherwise higher is better
+	bool lower_is_better;
+	// Differences smaller than this are not regressions, whatever the tolerance
+	double slack;
+	// The slack is for all nodes together. Memory is measured in whole pages, which
+	// matters on small maps.
+	bool slack_per_map;
+};
+
+// Metrics compared with the baseline. Nodes must match exactly. Exploration time is
+// compared instead of nodes per second, so small maps can get some slack.
+static const Metric metrics[] = {
+	{"explore_ms", true, 2, false},
+	{"equals_calls", true, 0, false},
+	{"bytes_per_node", true, 64 * 1024, true},
+	{"view_ms", true, 0.5, false},
+	{"move_view_ms", true, 0.5, false}
+};
+
+static const int NUM_METRICS = sizeof (metrics) / sizeof (metrics[0]);
+
+// Maps from small to large, relative to test1/src. The gen-* maps have few objects but a
+// large area, they come from
+//   test1MapGen -size 40x20 -walls 30 -blocks 0 -traps 4 -doors 2 -seed 1 -solvable
+//   test1MapGen -size 96x48 -walls 30 -blocks 0 -traps 12 -doors 2 -seed 1 -solvable
+static const char *default_maps[] = {
+	"../maps/tiny.txt",
+	"../maps/gen-40x20.txt",
+	"../map1.txt",
+	"../maps/small-room.txt",
+	"../maps/medium-room.txt",
+	"../src/test1-map.txt",
+	"../maps/gen-96x48.txt"
+};
+
+double get_metric (const Result *result, const char *name) {
+	if (!strcmp (name, "nodes")) return result->nodes;
+	if (!strcmp (name, "explore_ms")) return result->explore_ms;
+	if (!strcmp (name, "nodes_per_second")) return result->nodes_per_second;
+	if (!strcmp (name, "equals_calls")) return (double)result->equals_calls;
+	if (!strcmp (name, "bytes_per_node")) return result->bytes_per_node;
+	if (!strcmp (name, "view_ms")) return result->view_ms;
+	if (!strcmp (name, "move_view_ms")) return result->move_view_ms;
+	if (!strcmp (name, "process_peak_rss_mb")) return result->process_peak_rss_mb;
+	return 0;
+}
+
+double median (std::vector<double> &values) {
+	std::sort (values.begin (), values.end ());
+	return values[values.size () / 2];
+}
+
+double elapsed_ms (std::chrono::steady_clock::time_point start) {
+	std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now () - start;
+	return time.count ();
+}
+
+// Explore a map warmup + repeat times, and keep the median of the last repeat runs
+bool run (const char *map_filename, int warmup, int repeat, int horizon, Result *result) {
+	std::vector<double> explore_ms, bytes_per_node, view_ms, move_view_ms;
+
+	for (int r = 0; r < warmup + repeat; r++) {
+		release_free_memory ();
+		size_t memory = resident_memory ();
+		Game1::State *state = Game1::load_state (map_filename);
+		if (!state)
+			return false;
+
+		long long equals_calls = Game1::g_num_equals_calls;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+		Cass::Solver *solver = state->get_solver ();
+		solver->add_start_point (state);
+		solver->process_batch (INT_MAX, NULL);
+		double explore = elapsed_ms (start);
+		equals_calls = Game1::g_num_equals_calls - equals_calls;
+		// Memory freed by the previous run can be returned to the system meanwhile, so
+		// the resident size can even shrink
+		long long used = (long long)resident_memory () - (long long)memory;
+		if (used < 0)
+			used = 0;
+
+		solver->set_view_horizon (horizon);
+		start = std::chrono::steady_clock::now ();
+		solver->calc_view_state ();
+		double view = elapsed_ms (start);
+
+		double move_view = 0;
+		for (int i = 0; i < Game1::NUM_INPUTS; i++) {
+			if (!state->can_input ((Game1::Input)i))
+				continue;
+			state->input ((Game1::Input)i);
+			solver->update (i);
+			start = std::chrono::steady_clock::now ();
+			solver->calc_view_state ();
+			move_view = elapsed_ms (start);
+			break;
+		}
+
+		result->nodes = solver->get_num_nodes ();
+		result->equals_calls = equals_calls;
+		if (r >= warmup) {
+			explore_ms.push_back (explore);
+			bytes_per_node.push_back (used / (double)result->nodes);
+			view_ms.push_back (view);
+			move_view_ms.push_back (move_view);
+		}
+
+		delete solver;
+		delete state;
+	}
+
+	snprintf (result->map, sizeof (result->map), "%s", map_filename);
+	result->explore_ms = median (explore_ms);
+	result->nodes_per_second = result->explore_ms > 0 ? 1000 * result->nodes / result->explore_ms : 0;
+	result->bytes_per_node = median (bytes_per_node);
+	result->view_ms = median (view_ms);
+	result->move_view_ms = median (move_view_ms);
+	result->process_peak_rss_mb = peak_resident_memory () / (1024.0 * 1024.0);
+	return true;
+}
+
+void write_json (FILE *f, const std::vector<Result> &results, int warmup, int repeat, int horizon) {
+	fprintf (f, "{\n");
+	fprintf (f, "  \"warmup\": %d,\n  \"repeat\": %d,\n  \"horizon\": %d,\n", warmup, repeat, horizon);
+	fprintf (f, "  \"maps\": [\n");
+	for (size_t i = 0; i < results.size (); i++) {
+		const Result *r = &results[i];
+		fprintf (f, "    {\"map\": %s, \"nodes\": %d, \"explore_ms\": %.3f, \"nodes_per_second\": %.1f, "
+			"\"equals_calls\": %lld, \"bytes_per_node\": %.1f, \"view_ms\": %.3f, \"move_view_ms\": %.3f, "
+			"\"process_peak_rss_mb\": %.1f}%s\n", json_string (r->map).c_str (), r->nodes, r->explore_ms,
+			r->nodes_per_second, r->equals_calls, r->bytes_per_node, r->view_ms, r->move_view_ms,
+			r->process_peak_rss_mb, i + 1 < results.size () ? "," : "");
+	}
+	fprintf (f, "  ]\n}\n");
+}
+
+// Read the results of a previous run. This only understands the output of write_json ().
+bool read_json (const char *filename, std::vector<Result> *results) {
+	FILE *f = fopen (filename, "rb");
+	if (!f) {
+		printf ("Could not open %s\n", filename);
+		return false;
+	}
+	std::vector<char> text;
+	char buffer[4096];
+	size_t len;
+	while ((len = fread (buffer, 1, sizeof (buffer), f)) > 0)
+		text.insert (text.end (), buffer, buffer + len);
+	fclose (f);
+	text.push_back (0);
+
+	const char *p = &text[0];
+	while ((p = strstr (p, "{\"map\": ")) != NULL) {
+		Result result;
+		memset (&result, 0, sizeof (result));
+		std::string map;
+		const char *end = json_read_string (p + strlen ("{\"map\": "), &map);
+		const char *object_end = end ? strchr (end, '}') : NULL;
+		if (!object_end) {
+			printf ("Could not read %s\n", filename);
+			return false;
+		}
+		snprintf (result.map, sizeof (result.map), "%s", map.c_str ());
+
+		// Each field is "name": value, in any order
+		std::string object (end, object_end);
+		const char *names[] = {"nodes", "explore_ms", "nodes_per_second", "equals_calls", "bytes_per_node",
+			"view_ms", "move_view_ms", "process_peak_rss_mb"};
+		double values[8] = {0};
+		for (int i = 0; i < 8; i++) {
+			std::string key = std::string ("\"") + names[i] + "\": ";
+			size_t pos = object.find (key);
+			if (pos != std::string::npos)
+				values[i] = atof (object.c_str () + pos + key.size ());
+		}
+		result.nodes = (int)values[0];
+		result.explore_ms = values[1];
+		result.nodes_per_second = values[2];
+		result.equals_calls = (long long)values[3];
+		result.bytes_per_node = values[4];
+		result.view_ms = values[5];
+		result.move_view_ms = values[6];
+		result.process_peak_rss_mb = values[7];
+		results->push_back (result);
+		p = object_end;
+	}
+	return true;
+}
+
+// Print every metric which got worse than the baseline by more than tolerance (a fraction).
+// Returns the number of regressions.
+int compare (const std::vector<Result> &results, const std::vector<Result> &baseline, double tolerance) {
+	int regressions = 0;
+	for (size_t i = 0; i < results.size (); i++) {
+		const Result *result = &results[i], *base = NULL;
+		for (size_t j = 0; j < baseline.size () && !base; j++) {
+			if (!strcmp (baseline[j].map, result->map))
+				base = &baseline[j];
+		}
+		if (!base) {
+			fprintf (stderr, "%s: not in the baseline\n", result->map);
+			continue;
+		}
+		if (result->nodes != base->nodes) {
+			fprintf (stderr, "REGRESSION %s: %d nodes, baseline has %d\n", result->map, result->nodes, base->nodes);
+			regressions++;
+		}
+		for (int m = 0; m < NUM_METRICS; m++) {
+			double value = get_metric (result, metrics[m].name), base_value = get_metric (base, metrics[m].name);
+			double worse = metrics[m].lower_is_better ? value - base_value : base_value - value;
+			double slack = metrics[m].slack_per_map ? metrics[m].slack / result->nodes : metrics[m].slack;
+			bool regression = worse > slack && worse > tolerance * base_value;
+			fprintf (stderr, "%s%s %s: %.10g, baseline %.10g (%+.1f%%)\n", regression ? "REGRESSION " : "", result->map,
+				metrics[m].name, value, base_value, base_value ? 100 * (value - base_value) / base_value : 0.0);
+			if (regression)
+				regressions++;
+		}
+	}
+	return regressions;
+}
+
+int main (int argc, char *argv[]) {
+	int warmup = 1;
+	int repeat = 3;
+	int horizon = 0;
+	double tolerance = 0.1;
+	const char *baseline_filename = NULL;
+	const char *output_filename = NULL;
+	std::vector<const char *> maps;
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp (argv[a], "-warmup") && a + 1 < argc) {
+			warmup = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-repeat") && a + 1 < argc) {
+			repeat = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-horizon") && a + 1 < argc) {
+			horizon = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-baseline") && a + 1 < argc) {
+			baseline_filename = argv[++a];
+		} else if (!strcmp (argv[a], "-tolerance") && a + 1 < argc) {
+			tolerance = atof (argv[++a]) / 100;
+		} else if (!strcmp (argv[a], "-o") && a + 1 < argc) {
+			output_filename = argv[++a];
+		} else if (argv[a][0] != '-') {
+			maps.push_back (argv[a]);
+		} else {
+			printf ("Usage: %s [-warmup <runs>] [-repeat <runs>] [-horizon <steps>] [-o <results.json>]\n"
+				"       [-baseline <results.json> [-tolerance <percent>]] [map files]\n", argv[0]);
+			return -1;
+		}
+	}
+	if (repeat < 1)
+		repeat = 1;
+	if (maps.empty ())
+		maps.assign (default_maps, default_maps + sizeof (default_maps) / sizeof (default_maps[0]));
+
+	std::vector<Result> baseline;
+	if (baseline_filename && !read_json (baseline_filename, &baseline))
+		return -1;
+
+	std::vector<Result> results;
+	for (size_t i = 0; i < maps.size (); i++) {
+		Result result;
+		fprintf (stderr, "%s...\n", maps[i]);
+		if (!run (maps[i], warmup, repeat, horizon, &result))
+			return -1;
+		results.push_back (result);
+	}
+
+	write_json (stdout, results, warmup, repeat, horizon);
+	if (output_filename) {
+		FILE *f = fopen (output_filename, "w");
+		if (!f) {
+			printf ("Could not create %s\n", output_filename);
+			return -1;
+		}
+		write_json (f, results, warmup, repeat, horizon);
+		fclose (f);
+	}
+
+	if (baseline_filename) {
+		int regressions = compare (results, baseline, tolerance);
+		fprintf (stderr, "%d regressions\n", regressions);
+		return regressions ? 1 : 0;
+	}
+	return 0;
+}
@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include "Game1.h"
+
+// Compiles text maps into levels which Game1::load_state () reads without parsing
+
+// Needed by Game1, nothing is rendered here
+Game1::Renderer *Game1::g_renderer;
+
+int main (int argc, char *argv[]) {
+	if (argc != 3) {
+		printf ("Usage: %s <map file> <compiled level>\n", argv[0]);
+		return -1;
+	}
+	if (!Game1::compile_level (argv[1], argv[2]))
+		return -1;
+	return 0;
+}
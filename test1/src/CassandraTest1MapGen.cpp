@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes random Game1 maps in the text format read by Game1::load_state (). The same
+// options and seed always give the same map.
+
+// Small generator of our own, so maps do not depend on the C library's rand ()
+class Random {
+	unsigned long long state;
+
+public:
+	Random (unsigned long long seed) : state (seed) {}
+
+	// splitmix64
+	unsigned long long next () {
+		unsigned long long z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// Uniform in [0, n)
+	int below (int n) {
+		return (int)(next () % (unsigned long long)n);
+	}
+};
+
+class MapGenerator {
+	int width, height;
+	char *cells;
+	// Cells which must stay empty, so the goal can be reached
+	bool *reserved;
+	Random random;
+
+	char &cell (int x, int y) {
+		return cells[y * width + x];
+	}
+
+	bool is_inside (int x, int y) const {
+		return x > 0 && y > 0 && x < width - 1 && y < height - 1;
+	}
+
+	// Random walk from (x, y) to (goal_x, goal_y), mostly towards the goal
+	void carve_path (int x, int y, int goal_x, int goal_y) {
+		static const int dirs[4][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+		reserved[y * width + x] = true;
+		while (x != goal_x || y != goal_y) {
+			int dx = 0, dy = 0;
+			if (random.below (4)) {
+				if (x != goal_x && (y == goal_y || random.below (2)))
+					dx = x < goal_x ? 1 : -1;
+				else
+					dy = y < goal_y ? 1 : -1;
+			} else {
+				int dir = random.below (4);
+				dx = dirs[dir][0];
+				dy = dirs[dir][1];
+			}
+			if (!is_inside (x + dx, y + dy))
+				continue;
+			x += dx;
+			y += dy;
+			reserved[y * width + x] = true;
+		}
+	}
+
+	bool is_free (int x, int y) {
+		return cell (x, y) == '.' && !reserved[y * width + x];
+	}
+
+	// Pick a random interior cell which is still empty and not reserved. Returns false
+	// if there is none.
+	bool pick_free_cell (int *x, int *y) {
+		// Usually most cells are free, so try a few at random before counting them all
+		for (int i = 0; i < 64; i++) {
+			int cx = 1 + random.below (width - 2), cy = 1 + random.below (height - 2);
+			if (is_free (cx, cy)) {
+				*x = cx;
+				*y = cy;
+				return true;
+			}
+		}
+
+		int free_cells = 0;
+		for (int cy = 1; cy < height - 1; cy++) {
+			for (int cx = 1; cx < width - 1; cx++) {
+				if (is_free (cx, cy))
+					free_cells++;
+			}
+		}
+		if (!free_cells)
+			return false;
+		int n = random.below (free_cells);
+		for (int cy = 1; cy < height - 1; cy++) {
+			for (int cx = 1; cx < width - 1; cx++) {
+				if (is_free (cx, cy) && n-- == 0) {
+					*x = cx;
+					*y = cy;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	bool place (char c, int count, const char *name) {
+		for (int i = 0; i < count; i++) {
+			int x, y;
+			if (!pick_free_cell (&x, &y)) {
+				printf ("No room left for %d %s\n", count, name);
+				return false;
+			}
+			cell (x, y) = c;
+		}
+		return true;
+	}
+
+public:
+	MapGenerator (int width, int height, unsigned long long seed) : width (width), height (height), random (seed) {
+		cells = new char[width * height];
+		reserved = new bool[width * height];
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				cell (x, y) = is_inside (x, y) ? '.' : '#';
+				reserved[y * width + x] = false;
+			}
+		}
+	}
+
+	~MapGenerator () {
+		delete[] cells;
+		delete[] reserved;
+	}
+
+	// wall_percent of the interior cells become walls. If solvable, a path from the
+	// player to the goal is kept free of walls and objects, so the goal can always be
+	// reached without touching anything.
+	bool generate (int wall_percent, int blocks, int traps, int doors, bool solvable) {
+		int start_x = 1 + random.below (width - 2), start_y = 1 + random.below (height - 2);
+		int goal_x, goal_y;
+		do {
+			goal_x = 1 + random.below (width - 2);
+			goal_y = 1 + random.below (height - 2);
+		} while (goal_x == start_x && goal_y == start_y);
+		cell (start_x, start_y) = '@';
+		cell (goal_x, goal_y) = '*';
+		reserved[start_y * width + start_x] = true;
+		reserved[goal_y * width + goal_x] = true;
+		if (solvable)
+			carve_path (start_x, start_y, goal_x, goal_y);
+
+		for (int y = 1; y < height - 1; y++) {
+			for (int x = 1; x < width - 1; x++) {
+				if (cell (x, y) == '.' && !reserved[y * width + x] && random.below (100) < wall_percent)
+					cell (x, y) = '#';
+			}
+		}
+
+		if (!place ('%', blocks, "blocks") || !place ('^', traps, "traps"))
+			return false;
+		// Each trigger opens and closes the door with the same letter
+		for (int i = 0; i < doors; i++) {
+			if (!place ('A' + i, 1, "doors") || !place ('a' + i, 1, "triggers"))
+				return false;
+		}
+		return true;
+	}
+
+	bool write (FILE *f) {
+		fprintf (f, "%d, %d\n", width, height);
+		for (int y = 0; y < height; y++) {
+			fwrite (&cell (0, y), 1, width, f);
+			fprintf (f, "\n");
+		}
+		return !ferror (f);
+	}
+};
+
+int main (int argc, char *argv[]) {
+	int width = 20, height = 10;
+	int wall_percent = 20;
+	int blocks = 2, traps = 2, doors = 1;
+	unsigned long long seed = 1;
+	bool solvable = false;
+	const char *output_filename = NULL;
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp (argv[a], "-size") && a + 1 < argc) {
+			if (sscanf (argv[++a], "%dx%d", &width, &height) != 2)
+				width = height = 0;
+		} else if (!strcmp (argv[a], "-walls") && a + 1 < argc) {
+			wall_percent = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-blocks") && a + 1 < argc) {
+			blocks = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-traps") && a + 1 < argc) {
+			traps = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-doors") && a + 1 < argc) {
+			doors = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-seed") && a + 1 < argc) {
+			seed = strtoull (argv[++a], NULL, 10);
+		} else if (!strcmp (argv[a], "-solvable")) {
+			solvable = true;
+		} else if (!strcmp (argv[a], "-o") && a + 1 < argc) {
+			output_filename = argv[++a];
+		} else {
+			printf ("Usage: %s [-size <width>x<height>] [-walls <percent>] [-blocks <n>] [-traps <n>]\n"
+				"       [-doors <n>] [-seed <n>] [-solvable] [-o <map file>]\n", argv[0]);
+			return -1;
+		}
+	}
+	// The player and the goal need two cells inside the border walls
+	if (width < 3 || height < 3 || (width - 2) * (height - 2) < 2) {
+		printf ("Invalid map size %dx%d\n", width, height);
+		return -1;
+	}
+	if (wall_percent < 0 || wall_percent > 100 || blocks < 0 || traps < 0) {
+		printf ("Invalid wall percent or number of objects\n");
+		return -1;
+	}
+	// Doors and triggers are paired by letter
+	if (doors < 0 || doors > 26) {
+		printf ("There can only be 0 to 26 doors\n");
+		return -1;
+	}
+
+	MapGenerator generator (width, height, seed);
+	if (!generator.generate (wall_percent, blocks, traps, doors, solvable))
+		return -1;
+
+	FILE *f = stdout;
+	if (output_filename) {
+		f = fopen (output_filename, "w");
+		if (!f) {
+			printf ("Could not create %s\n", output_filename);
+			return -1;
+		}
+	}
+	bool ok = generator.write (f);
+	if (output_filename)
+		ok = (fclose (f) == 0) && ok;
+	if (!ok) {
+		printf ("Could not write the map\n");
+		return -1;
+	}
+	return 0;
+}
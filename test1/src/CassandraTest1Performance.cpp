@@ -1,6 +1,11 @@
 #include "Game1.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <time.h>
+#include <chrono>
+#include <thread>
 
 #ifdef _WIN32
 
@@ -37,52 +42,403 @@ size_t used_memory () {
 
 Game1::Renderer *Game1::g_renderer;
 
+// Cells are rendered into a character frame. present () compares it with the frame on
+// the terminal and writes only the runs of cells which changed, in a single write.
 class Renderer : public Game1::Renderer {
+	enum Color {
+		COLOR_NONE,
+		COLOR_GHOST,  // Ghost which might still reach the goal
+		COLOR_GOAL    // Ghost on the way to the goal
+	};
+
+	struct Cell {
+		char c;
+		unsigned char color;
+	};
+
+	int width, height;
+	Cell *frame;
+	// What the terminal shows. Cells with c == 0 are unknown.
+	Cell *shown;
+	bool ghosts;
+	char *output;
+	int output_size, output_capacity;
+	long bytes_written;
+
+	void put (int x, int y, char c, float alpha) {
+		if (x < 0 || y < 0 || x >= width || y >= height)
+			return;
+		Cell *cell = &frame[y * width + x];
+		cell->c = c;
+		cell->color = !ghosts ? COLOR_NONE : alpha < 1.f ? COLOR_GHOST : COLOR_GOAL;
+	}
+
+	void append (const char *text, int size) {
+		if (output_size + size > output_capacity) {
+			while (output_size + size > output_capacity)
+				output_capacity *= 2;
+			output = (char *)realloc (output, output_capacity);
+		}
+		memcpy (output + output_size, text, size);
+		output_size += size;
+	}
+
+	void append_color (int color) {
+		static const char *codes[] = {"\E[0m", "\E[0;2;36m", "\E[0;1;32m"};
+		append (codes[color], (int)strlen (codes[color]));
+	}
+
 public:
-	void renderPlayer (int x, int y, bool dead, bool won, float alpha) { printf ("\E[%d;%dH@", y+1, x+1); }
-	void renderEmptyCell (int x, int y, float alpha) { printf ("\E[%d;%dH ", y+1, x+1); }
-	void renderWallCell (int x, int y, float alpha)  { printf ("\E[%d;%dH#", y+1, x+1); }
-	void renderTrapCell (int x, int y, float alpha)  { printf ("\E[%d;%dH^", y+1, x+1); }
-	void renderDoorCell (int x, int y, bool open, float alpha)  { printf ("\E[%d;%dH+", y+1, x+1); }
-	void renderTriggerCell (int x, int y, float alpha)  { printf ("\E[%d;%dH.", y+1, x+1); }
-	void renderPushableBlockCell (int x, int y, float alpha)  { printf ("\E[%d;%dH%%", y+1, x+1); }
-	void renderGoalCell (int x, int y, float alpha)  { printf ("\E[%d;%dH0", y+1, x+1); }
+	Renderer () : width (0), height (0), frame (NULL), shown (NULL), ghosts (false),
+			output_size (0), output_capacity (4096), bytes_written (0) {
+		output = (char *)malloc (output_capacity);
+	}
+
+	~Renderer () {
+		delete[] frame;
+		delete[] shown;
+		free (output);
+	}
+
+	// Set the size of the map, and clear the screen when the next frame is presented
+	void resize (int width, int height) {
+		delete[] frame;
+		delete[] shown;
+		this->width = width;
+		this->height = height;
+		frame = new Cell[width * height];
+		shown = new Cell[width * height];
+		for (int i = 0; i < width * height; i++) {
+			frame[i].c = ' ';
+			frame[i].color = shown[i].color = COLOR_NONE;
+			shown[i].c = 0;
+		}
+		output_size = 0;
+		append ("\E[2J", 4);
+	}
+
+	// Cells rendered from now until present () are ghosts over the present state
+	void begin_ghosts () {
+		ghosts = true;
+	}
+
+	// Update the terminal. The cursor is left where it was, so text printed between
+	// frames stays in place.
+	void present () {
+		char move[32];
+		int color = COLOR_NONE;
+		append ("\E7", 2);
+		for (int y = 0; y < height; y++) {
+			int x = 0;
+			while (x < width) {
+				const Cell *cell = &frame[y * width + x];
+				Cell *old = &shown[y * width + x];
+				if (cell->c == old->c && cell->color == old->color) {
+					x++;
+					continue;
+				}
+				// A run of changed cells only needs one cursor movement
+				append (move, snprintf (move, sizeof (move), "\E[%d;%dH", y + 1, x + 1));
+				while (x < width && (cell->c != old->c || cell->color != old->color)) {
+					if (cell->color != color) {
+						color = cell->color;
+						append_color (color);
+					}
+					append (&cell->c, 1);
+					*old = *cell;
+					x++;
+					cell++;
+					old++;
+				}
+			}
+		}
+		if (color != COLOR_NONE)
+			append_color (COLOR_NONE);
+		append ("\E8", 2);
+
+		// Anything printed before has to come out first
+		fflush (stdout);
+#ifdef _WIN32
+		fwrite (output, 1, output_size, stdout);
+		fflush (stdout);
+#else
+		for (int written = 0; written < output_size; ) {
+			ssize_t result = write (STDOUT_FILENO, output + written, output_size - written);
+			if (result <= 0)
+				break;
+			written += (int)result;
+		}
+#endif
+		bytes_written += output_size;
+		output_size = 0;
+		ghosts = false;
+	}
+
+	// Bytes sent to the terminal so far
+	long get_bytes_written () const {
+		return bytes_written;
+	}
+
+	void renderPlayer (int x, int y, bool dead, bool won, float alpha) { put (x, y, '@', alpha); }
+	void renderEmptyCell (int x, int y, float alpha) { put (x, y, ' ', alpha); }
+	void renderWallCell (int x, int y, float alpha)  { put (x, y, '#', alpha); }
+	void renderTrapCell (int x, int y, float alpha)  { put (x, y, '^', alpha); }
+	void renderDoorCell (int x, int y, bool open, float alpha)  { put (x, y, '+', alpha); }
+	void renderTriggerCell (int x, int y, float alpha)  { put (x, y, '.', alpha); }
+	void renderPushableBlockCell (int x, int y, float alpha)  { put (x, y, '%', alpha); }
+	void renderGoalCell (int x, int y, float alpha)  { put (x, y, '0', alpha); }
 };
 
+// Show the ghosts at each distance in turn, up to depth steps ahead
+void animate (Game1::State *state, Cass::Solver *solver, Renderer *renderer, int cycles, int depth) {
+	Game1::GhostField ghosts;
+	long bytes = renderer->get_bytes_written ();
+	int frames = 0;
+	double render_time = 0;
+	for (int cycle = 0; cycle < cycles; cycle++) {
+		for (int distance = 0; distance < depth; distance++) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+			state->render (1.f);
+			ghosts.build (solver, distance, state);
+			renderer->begin_ghosts ();
+			ghosts.render ();
+			renderer->present ();
+			std::chrono::duration<double, std::milli> frame_time = std::chrono::steady_clock::now () - start;
+			render_time += frame_time.count ();
+			frames++;
+			std::this_thread::sleep_for (std::chrono::milliseconds (100));
+		}
+	}
+	printf ("Animated %d frames, %gms and %ld bytes per frame\n", frames, render_time / frames,
+		(renderer->get_bytes_written () - bytes) / frames);
+}
+
+// Explore the level with an Explorer instead of a Solver, which does not keep the
+// state graph in memory
+int explore (Game1::State *state, Cass::Explorer *explorer, bool show_memory, const char *trace_filename) {
+	if (!explorer) {
+		delete state;
+		return -1;
+	}
+	clock_t time = clock ();
+	explorer->add_start_point (state);
+	while (!explorer->done ()) {
+		explorer->process ();
+	}
+	time = clock () - time;
+	float ms = 1000 * time / (float)CLOCKS_PER_SEC;
+
+	printf ("Map size is %dx%d\n", state->get_map_size_x (), state->get_map_size_y ());
+	printf ("Explored %ld states in %gms (%g states/s) and used %gMB\n", explorer->get_num_states (), ms,
+		explorer->get_num_states () / (ms / 1000), used_memory () / (float)(1024 * 1024));
+	printf ("Maximum depth is %d, goal distance is %d\n", explorer->get_depth (), explorer->get_goal_distance ());
+	if (explorer->get_collision_probability () > 0)
+		printf ("Collision probability is %g\n", explorer->get_collision_probability ());
+	if (trace_filename && Cass::write_trace (trace_filename))
+		printf ("Trace written to %s\n", trace_filename);
+	if (show_memory)
+		Cass::print_memory_stats ();
+
+	int result = explorer->has_failed () ? -1 : 0;
+	delete explorer;
+	delete state;
+	return result;
+}
+
+// Explore the level with the solver and with each explorer, which must all find the same
+// number of states. Explorers only see packed states, so this catches states which the
+// game compares differently from their packed form.
+int check_explorers (const char *map_filename, const char *work_dir) {
+	Game1::State *state = Game1::load_state (map_filename);
+	if (!state)
+		return -1;
+	Cass::Solver *solver = state->get_solver ();
+	solver->add_start_point (state);
+	solver->process_batch (INT_MAX, NULL);
+	long num_states = solver->get_num_nodes ();
+	delete solver;
+	printf ("The solver found %ld states\n", num_states);
+
+	const char *names[2] = { "external explorer", "bitstate explorer" };
+	Cass::Explorer *explorers[2] = {
+		Cass::get_external_explorer (work_dir, Game1::NUM_INPUTS, 64 * 1024 * 1024),
+		Cass::get_bitstate_explorer (28, Game1::NUM_INPUTS)
+	};
+	int result = 0;
+	for (int i = 0; i < 2; i++) {
+		Cass::Explorer *explorer = explorers[i];
+		if (!explorer) {
+			result = -1;
+			continue;
+		}
+		explorer->add_start_point (state);
+		while (!explorer->done ()) {
+			explorer->process ();
+		}
+		if (explorer->has_failed ()) {
+			result = -1;
+		} else if (explorer->get_num_states () != num_states) {
+			printf ("The %s found %ld states\n", names[i], explorer->get_num_states ());
+			result = -1;
+		}
+		delete explorer;
+	}
+	delete state;
+	return result;
+}
+
+static void print_stats (Cass::Solver *solver) {
+	Cass::SolverStats stats = solver->get_stats ();
+	printf ("Expanded %lld nodes into %lld children, %lld of them duplicates, with %lld state comparisons\n",
+		stats.nodes_expanded, stats.children_generated, stats.duplicates, stats.equals_calls);
+	printf ("Maximum depth is %d, %d nodes left in the frontier\n", stats.max_depth, stats.frontier_size);
+	if (stats.evicted_nodes > 0)
+		printf ("Evicted %lld nodes, %d stubs left to expand again\n", stats.evicted_nodes, stats.stub_nodes);
+	if (stats.goal_nodes_expanded >= 0)
+		printf ("First goal found after expanding %lld nodes in %gms\n", stats.goal_nodes_expanded, 1000 * stats.goal_time);
+	printf ("Hash buckets with 0..%d+ nodes:", Cass::SolverStats::CHAIN_HISTOGRAM_SIZE - 1);
+	for (int i = 0; i < Cass::SolverStats::CHAIN_HISTOGRAM_SIZE; i++)
+		printf (" %d", stats.chain_histogram[i]);
+	printf (" (of %d, longest chain %d)\n", stats.num_hash_buckets, stats.longest_chain);
+	printf ("Memory: %gMB in nodes, %gMB in transitions, %gMB in states\n", stats.node_bytes / (1024.0 * 1024.0),
+		stats.transition_bytes / (1024.0 * 1024.0), stats.state_bytes / (1024.0 * 1024.0));
+	printf ("Time: %gms processing, %gms calculating view states\n", 1000 * stats.process_time, 1000 * stats.view_time);
+}
+
 int main (int argc, char *argv[]) {
 	clock_t time;
+	const char *map_filename = "../src/test1-map.txt";
+	const char *external_dir = NULL;
+	const char *check_dir = NULL;
+	int bitstate_bits = 0;
+	int heuristic_weight = 0;
+	int horizon = 0;
+	int budget_mb = 0;
+	int animate_cycles = 0;
+	bool use_cache = false;
+	bool pause = false;
+	bool show_stats = false;
+	bool show_memory = false;
+	const char *trace_filename = NULL;
     Renderer renderer;
 	Game1::g_renderer = &renderer;
-	
-	Game1::State *current_state = Game1::load_state ("../src/test1-map.txt");
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp (argv[a], "-external") && a + 1 < argc) {
+			external_dir = argv[++a];
+		} else if (!strcmp (argv[a], "-check-explorers") && a + 1 < argc) {
+			check_dir = argv[++a];
+		} else if (!strcmp (argv[a], "-bitstate") && a + 1 < argc) {
+			bitstate_bits = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-best-first") && a + 1 < argc) {
+			heuristic_weight = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-horizon") && a + 1 < argc) {
+			horizon = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-budget") && a + 1 < argc) {
+			budget_mb = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-animate") && a + 1 < argc) {
+			animate_cycles = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-cache")) {
+			use_cache = true;
+		} else if (!strcmp (argv[a], "-pause")) {
+			pause = true;
+		} else if (!strcmp (argv[a], "-stats")) {
+			show_stats = true;
+		} else if (!strcmp (argv[a], "-memory")) {
+			show_memory = true;
+		} else if (!strcmp (argv[a], "-trace") && a + 1 < argc) {
+			trace_filename = argv[++a];
+		} else if (argv[a][0] != '-') {
+			map_filename = argv[a];
+		} else {
+			printf ("Usage: %s [-external <work dir> | -bitstate <log2 bits> | -best-first <weight> | -check-explorers <work dir>] [-horizon <steps>] [-budget <MB>] [-animate <cycles>] [-cache] [-stats] [-memory] [-trace <file>] [-pause] [map file]\n", argv[0]);
+			return -1;
+		}
+	}
+
+	if (check_dir)
+		return check_explorers (map_filename, check_dir);
+
+	Cass::set_trace_thread_name ("main");
+	if (trace_filename)
+		Cass::start_tracing ();
+	Game1::State *current_state = Game1::load_state (map_filename);
 	if (!current_state)
 		return -1;
-	Cass::Solver *solver = current_state->get_solver ();
-	solver->add_start_point (current_state);
+	if (external_dir)
+		return explore (current_state, Cass::get_external_explorer (external_dir, Game1::NUM_INPUTS, 64 * 1024 * 1024), show_memory, trace_filename);
+	if (bitstate_bits > 0)
+		return explore (current_state, Cass::get_bitstate_explorer (bitstate_bits, Game1::NUM_INPUTS), show_memory, trace_filename);
+
+	// The explored graph is cached next to the map
+	char cache_filename[1024];
+	unsigned int checksum = Cass::get_file_checksum (map_filename);
+	snprintf (cache_filename, sizeof (cache_filename), "%s.cass", map_filename);
+
 	time = clock ();
-	int i = 0;
-	while (!solver->done ()) {
-		solver->process ();
-		i++;
-	}
+	Cass::Solver *solver = NULL;
+	if (use_cache)
+		solver = Cass::load_solver (cache_filename, checksum, Game1::NUM_INPUTS);
+	bool cached = solver != NULL;
+	if (!solver && heuristic_weight > 0)
+		solver = current_state->get_best_first_solver (heuristic_weight);
+	if (!solver)
+		solver = current_state->get_solver ();
+	solver->add_start_point (current_state);
+	solver->set_view_horizon (horizon);
+	solver->set_memory_budget (budget_mb * 1024LL * 1024);
+	solver->process_batch (INT_MAX, NULL);
 	time = clock () - time;
+	if (use_cache && !cached)
+		solver->save (cache_filename, checksum);
 #ifndef _WIN32
-	printf ("\E[2J");
+	renderer.resize (current_state->get_map_size_x (), current_state->get_map_size_y ());
 	current_state->render (1.f);
+	renderer.present ();
 	printf ("\E[%d;%dH", current_state->get_map_size_y () + 2, 1);
 #endif
 	printf ("Map size is %dx%d\n", current_state->get_map_size_x (), current_state->get_map_size_y ());
-	printf ("Processed %d nodes in %gms and used %gMB\n", i, 1000 * time / (float)CLOCKS_PER_SEC, used_memory () / (float)(1024 * 1024));
+	if (cached)
+		printf ("Loaded %s in %gms\n", cache_filename, 1000 * time / (float)CLOCKS_PER_SEC);
+	else
+		printf ("Processed %d nodes in %gms and used %gMB\n", solver->get_num_nodes (), 1000 * time / (float)CLOCKS_PER_SEC, used_memory () / (float)(1024 * 1024));
 
-	time = clock ();
+	// Wall time, clock () would add up the time of all threads
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
 	solver->calc_view_state ();
-	time = clock () - time;
-	printf ("Solved view states in %gms\n", 1000 * time / (float)CLOCKS_PER_SEC);
+	std::chrono::duration<double, std::milli> view_time = std::chrono::steady_clock::now () - start;
+	printf ("Solved view states in %gms\n", view_time.count ());
+
+	// Updating the view state after a move is what happens most while playing
+	for (int i = 0; i < Game1::NUM_INPUTS; i++) {
+		if (!current_state->can_input ((Game1::Input)i))
+			continue;
+		current_state->input ((Game1::Input)i);
+		solver->update (i);
+		start = std::chrono::steady_clock::now ();
+		solver->calc_view_state ();
+		view_time = std::chrono::steady_clock::now () - start;
+		printf ("Updated view states after a move in %gms\n", view_time.count ());
+		break;
+	}
+
+	if (show_stats)
+		print_stats (solver);
+	if (trace_filename && Cass::write_trace (trace_filename))
+		printf ("Trace written to %s\n", trace_filename);
+	if (show_memory)
+		Cass::print_memory_stats ();
+
+#ifndef _WIN32
+	// Ghosts of the state after the move above, as in the GUI test
+	if (animate_cycles > 0)
+		animate (current_state, solver, &renderer, animate_cycles, horizon > 0 ? horizon : 6);
+#endif
 
 	delete current_state;
 	delete solver;
 
-	if (argc > 1) {
+	if (pause) {
 		printf ("Press ENTER");
 		printf ("%c", getchar ());
 	}
@@ -0,0 +1,322 @@
+#include "Game1.h"
+#include "Json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+# include <Windows.h>
+#else
+# include <dirent.h>
+# include <sys/stat.h>
+#endif
+
+Game1::Renderer *Game1::g_renderer;
+
+// How often the deadline is checked, in seconds of exploring
+#define CHECK_INTERVAL 0.1
+
+// What became of a map
+enum Status {
+	SOLVED,        // Everything was explored and a goal can be reached
+	UNSOLVABLE,    // Everything was explored and no goal can be reached
+	TIMEOUT,       // The time limit was reached first
+	OUT_OF_MEMORY, // The memory limit was reached first
+	LOAD_ERROR     // The map could not be loaded
+};
+
+static const char *status_names[] = {"solved", "unsolvable", "timeout", "memory", "error"};
+
+struct Result {
+	std::string map;
+	Status status;
+	// Shortest solution, -1 if none was found. Exploration is breadth-first, so it is
+	// known as soon as a goal is found, even if the time limit is reached later. The
+	// memory limit may make the solver forget it again.
+	int solution_length;
+	int states;
+	int max_depth;
+	double explore_ms;
+	double memory_mb;
+};
+
+// Limits for every map, 0 for none
+struct Limits {
+	double seconds;
+	long long bytes;
+};
+
+// Text maps and compiled levels have no fixed extension, so every file in a directory
+// is taken for a map, except hidden files and graphs cached by test1Performance -cache
+static bool is_map_file (const char *name) {
+	size_t length = strlen (name);
+	return name[0] != '.' && !(length > 5 && !strcmp (name + length - 5, ".cass"));
+}
+
+// Add the maps in a directory, or the path itself if it is a file. Returns false if it
+// cannot be read.
+static bool add_maps (const char *path, std::vector<std::string> *maps) {
+	std::vector<std::string> found;
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA (path);
+	if (attributes == INVALID_FILE_ATTRIBUTES)
+		return false;
+	if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+		maps->push_back (path);
+		return true;
+	}
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA ((std::string (path) + "\\*").c_str (), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return false;
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && is_map_file (data.cFileName))
+			found.push_back (std::string (path) + "\\" + data.cFileName);
+	} while (FindNextFileA (find, &data));
+	FindClose (find);
+#else
+	struct stat st;
+	if (stat (path, &st) != 0)
+		return false;
+	if (!S_ISDIR (st.st_mode)) {
+		maps->push_back (path);
+		return true;
+	}
+	DIR *dir = opendir (path);
+	if (!dir)
+		return false;
+	struct dirent *entry;
+	while ((entry = readdir (dir)) != NULL) {
+		std::string filename = std::string (path) + "/" + entry->d_name;
+		if (is_map_file (entry->d_name) && stat (filename.c_str (), &st) == 0 && S_ISREG (st.st_mode))
+			found.push_back (filename);
+	}
+	closedir (dir);
+#endif
+	// Directory order is arbitrary, reports should not be
+	std::sort (found.begin (), found.end ());
+	maps->insert (maps->end (), found.begin (), found.end ());
+	return true;
+}
+
+static long long get_file_size (const char *filename) {
+	FILE *f = fopen (filename, "rb");
+	if (!f)
+		return 0;
+	fseek (f, 0, SEEK_END);
+	long long size = ftell (f);
+	fclose (f);
+	return size;
+}
+
+// Explore a whole map with its own solver, within the limits. The memory limit is the
+// solver's budget: it keeps count of its memory as it grows, and the map is out of
+// memory as soon as the graph no longer fits and nodes have to be forgotten.
+static void validate (const char *map_filename, const Limits &limits, Result *result) {
+	result->map = map_filename;
+	result->solution_length = -1;
+	result->states = 0;
+	result->max_depth = 0;
+	result->explore_ms = 0;
+	result->memory_mb = 0;
+
+	Game1::State *state = Game1::load_state (map_filename);
+	if (!state) {
+		result->status = LOAD_ERROR;
+		return;
+	}
+	Cass::Solver *solver = state->get_solver ();
+	solver->set_memory_budget (limits.bytes);
+	double start = Cass::get_time ();
+	double deadline = limits.seconds > 0 ? start + limits.seconds : 0;
+	solver->add_start_point (state);
+	result->status = UNSOLVABLE;
+	for (;;) {
+		double now = Cass::get_time ();
+		if (deadline && now >= deadline) {
+			result->status = TIMEOUT;
+			break;
+		}
+		double slice_end = now + CHECK_INTERVAL;
+		solver->process_for (deadline && deadline < slice_end ? deadline : slice_end, NULL);
+		if (solver->has_evicted ()) {
+			result->status = OUT_OF_MEMORY;
+			break;
+		}
+		if (solver->done ())
+			break;
+	}
+	result->explore_ms = 1000 * (Cass::get_time () - start);
+
+	// Measuring goes through all nodes, once is enough
+	Cass::SolverStats stats = solver->get_stats ();
+	if (result->status == UNSOLVABLE && stats.goal_depth >= 0)
+		result->status = SOLVED;
+	result->states = solver->get_num_nodes ();
+	result->max_depth = stats.max_depth;
+	result->solution_length = stats.goal_depth;
+	result->memory_mb = (stats.node_bytes + stats.transition_bytes + stats.state_bytes) / (1024.0 * 1024.0);
+
+	delete solver;
+	delete state;
+}
+
+// Every thread takes the next map until there are none left, so a long map does not
+// hold up the maps after it
+class ValidateTask {
+public:
+	ValidateTask (const std::vector<std::string> &maps, const std::vector<int> &order, const Limits &limits,
+			std::vector<Result> *results) : maps (maps), order (order), limits (limits), results (results),
+			next (0), finished (0) {}
+
+	void run () {
+		for (;;) {
+			int i = next++;
+			if (i >= (int)order.size ())
+				break;
+			int map = order[i];
+			Result *result = &(*results)[map];
+			validate (maps[map].c_str (), limits, result);
+
+			std::lock_guard<std::mutex> lock (mutex);
+			fprintf (stderr, "[%d/%d] %s: %s", ++finished, (int)maps.size (), result->map.c_str (), status_names[result->status]);
+			if (result->solution_length >= 0)
+				fprintf (stderr, ", shortest solution %d steps", result->solution_length);
+			fprintf (stderr, ", %d states in %.0fms\n", result->states, result->explore_ms);
+		}
+	}
+
+private:
+	const std::vector<std::string> &maps;
+	// Biggest files first, so the longest maps do not start last
+	const std::vector<int> &order;
+	Limits limits;
+	std::vector<Result> *results;
+	std::atomic<int> next;
+	int finished;
+	std::mutex mutex;
+};
+
+// Map paths can hold backslashes (on Windows), quotes and commas
+static std::string csv_field (const std::string &text) {
+	std::string quoted = "\"";
+	for (size_t i = 0; i < text.size (); i++) {
+		if (text[i] == '"')
+			quoted += '"';
+		quoted += text[i];
+	}
+	return quoted + "\"";
+}
+
+static void write_csv (FILE *f, const std::vector<Result> &results) {
+	fprintf (f, "map,status,solution_length,states,max_depth,explore_ms,memory_mb\n");
+	for (size_t i = 0; i < results.size (); i++) {
+		const Result *r = &results[i];
+		fprintf (f, "%s,%s,%d,%d,%d,%.3f,%.1f\n", csv_field (r->map).c_str (), status_names[r->status], r->solution_length,
+			r->states, r->max_depth, r->explore_ms, r->memory_mb);
+	}
+}
+
+static void write_json (FILE *f, const std::vector<Result> &results, const Limits &limits, int num_threads) {
+	fprintf (f, "{\n");
+	fprintf (f, "  \"threads\": %d,\n  \"time_limit\": %g,\n  \"memory_limit_mb\": %g,\n", num_threads,
+		limits.seconds, limits.bytes / (1024.0 * 1024.0));
+	fprintf (f, "  \"maps\": [\n");
+	for (size_t i = 0; i < results.size (); i++) {
+		const Result *r = &results[i];
+		fprintf (f, "    {\"map\": %s, \"status\": \"%s\", \"solution_length\": %d, \"states\": %d, "
+			"\"max_depth\": %d, \"explore_ms\": %.3f, \"memory_mb\": %.1f}%s\n", json_string (r->map).c_str (),
+			status_names[r->status], r->solution_length, r->states, r->max_depth, r->explore_ms, r->memory_mb,
+			i + 1 < results.size () ? "," : "");
+	}
+	fprintf (f, "  ]\n}\n");
+}
+
+int main (int argc, char *argv[]) {
+	int num_threads = 0;
+	Limits limits = {0, 0};
+	bool json = false;
+	const char *output_filename = NULL;
+	std::vector<std::string> maps;
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp (argv[a], "-threads") && a + 1 < argc) {
+			num_threads = atoi (argv[++a]);
+		} else if (!strcmp (argv[a], "-time") && a + 1 < argc) {
+			limits.seconds = atof (argv[++a]);
+		} else if (!strcmp (argv[a], "-memory") && a + 1 < argc) {
+			limits.bytes = (long long)(atof (argv[++a]) * 1024 * 1024);
+		} else if (!strcmp (argv[a], "-json")) {
+			json = true;
+		} else if (!strcmp (argv[a], "-o") && a + 1 < argc) {
+			output_filename = argv[++a];
+		} else if (argv[a][0] != '-') {
+			if (!add_maps (argv[a], &maps)) {
+				printf ("Could not read %s\n", argv[a]);
+				return -1;
+			}
+		} else {
+			printf ("Usage: %s [-threads <count>] [-time <seconds per map>] [-memory <MB per map>]\n"
+				"       [-json] [-o <report>] <map directories or files>\n", argv[0]);
+			return -1;
+		}
+	}
+	if (maps.empty ()) {
+		printf ("No maps to validate\n");
+		return -1;
+	}
+	// A report named .json is always JSON
+	if (output_filename && strlen (output_filename) > 5 && !strcmp (output_filename + strlen (output_filename) - 5, ".json"))
+		json = true;
+
+	std::vector<long long> sizes (maps.size ());
+	std::vector<int> order (maps.size ());
+	for (size_t i = 0; i < maps.size (); i++) {
+		sizes[i] = get_file_size (maps[i].c_str ());
+		order[i] = (int)i;
+	}
+	std::stable_sort (order.begin (), order.end (), [&sizes] (int a, int b) { return sizes[a] > sizes[b]; });
+
+	// Each thread runs one solver at a time, so there is no point in more threads than maps
+	if (num_threads <= 0)
+		num_threads = std::thread::hardware_concurrency ();
+	num_threads = std::min (std::max (num_threads, 1), (int)maps.size ());
+	std::vector<Result> results (maps.size ());
+	ValidateTask task (maps, order, limits, &results);
+	double start = Cass::get_time ();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_threads; i++)
+		threads.push_back (std::thread (&ValidateTask::run, &task));
+	for (int i = 0; i < num_threads; i++)
+		threads[i].join ();
+	fprintf (stderr, "Validated %d maps with %d threads in %.0fms\n", (int)maps.size (), num_threads,
+		1000 * (Cass::get_time () - start));
+
+	FILE *f = stdout;
+	if (output_filename) {
+		f = fopen (output_filename, "w");
+		if (!f) {
+			printf ("Could not create %s\n", output_filename);
+			return -1;
+		}
+	}
+	if (json)
+		write_json (f, results, limits, num_threads);
+	else
+		write_csv (f, results);
+	if (f != stdout)
+		fclose (f);
+
+	// Fails unless every map can be solved, for scripts
+	for (size_t i = 0; i < results.size (); i++) {
+		if (results[i].status != SOLVED)
+			return 1;
+	}
+	return 0;
+}
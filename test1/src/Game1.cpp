@@ -3,25 +3,32 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory.h>
+#include <vector>
 #include "Game1.h"
 
+// new is not redefined for the debug CRT here, since cells and states have their own
+// operator new to count them (see Cass::allocate ())
 #ifdef _WIN32
 #include <crtdbg.h>
-#ifdef _DEBUG
-#ifndef DBG_NEW
-#define DBG_NEW new ( _NORMAL_BLOCK , __FILE__ , __LINE__ )
-#define new DBG_NEW
-#endif
-#endif  // _DEBUG
 #endif
 
 namespace Game1 {
 
 	static const int dirs[4][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+	// Cell indices in packed states must fit in an int
+	static const long long MAX_MAP_CELLS = 1 << 28;
+
+	thread_local long long g_num_equals_calls;
+
+	// Memory of the game, counted apart from the solver's
+	static const int MEMORY_STATES = Cass::add_memory_tag ("states");
+	static const int MEMORY_MAPS = Cass::add_memory_tag ("maps");
+	static const int MEMORY_CELLS = Cass::add_memory_tag ("cells");
 	
 	class StateImplementation;
 	struct Cell;
 	struct EmptyCell;
+	struct FakeWall;
 	struct WallCell;
 	struct TrapCell;
 	struct DoorCell;
@@ -29,6 +36,22 @@ namespace Game1 {
 	struct PushableBlockCell;
 	struct GoalCell;
 
+	// Cells can be packed into a single byte: the kind of cell plus some flags
+	enum CellCode {
+		CODE_EMPTY,
+		CODE_WALL,
+		CODE_TRAP,
+		CODE_DOOR,
+		CODE_TRIGGER,
+		CODE_GOAL,
+		CODE_FAKE_WALL,
+		CODE_KIND_MASK = 0x07,
+		CODE_OPEN = 0x08,     // Doors only
+		CODE_BLOCK = 0x10     // A pushable block lies on top of this cell
+	};
+
+	static Cell *make_cell (unsigned char code, int x, int y, const StateImplementation *original);
+
 	struct Player {
 		int x, y;
 		bool dead;
@@ -43,8 +66,7 @@ namespace Game1 {
 
 	struct Map {
 		Map (int sizex, int sizey) : sizex (sizex), sizey (sizey) {
-			cells = new Cell*[sizex * sizey];
-			memset (cells, 0, sizex * sizey * sizeof (Cell *));
+			cells = (Cell **)Cass::allocate_zeroed (sizex * sizey * sizeof (Cell *), MEMORY_MAPS);
 		}
 
 		~Map ();
@@ -68,16 +90,24 @@ namespace Game1 {
 
 		virtual ~Cell () {}
 
+		static void *operator new (size_t size) { return Cass::allocate (size, MEMORY_CELLS); }
+		static void operator delete (void *p, size_t size) { Cass::release (p, size, MEMORY_CELLS); }
+
 		virtual void render (float alpha) const = 0;
 		virtual Cell *clone () const = 0;
+		virtual unsigned char get_code () const = 0;
+		// Bytes used by this cell
+		virtual int get_size () const = 0;
 
 		virtual bool can_pass (const StateImplementation *state, int incoming_dir) const = 0;
 		virtual void pass (StateImplementation *state, int incoming_dir) {};
 		virtual bool is_hole () const { return false; }
+		virtual bool is_block () const { return false; }
 		virtual void toggle () {}
 
 		virtual bool equals (const Cell *cell) const = 0;
 		virtual bool equals (const EmptyCell *cell) const { return false; }
+		virtual bool equals (const FakeWall *cell) const { return false; }
 		virtual bool equals (const WallCell *cell) const { return false; }
 		virtual bool equals (const TrapCell *cell) const { return false; }
 		virtual bool equals (const PushableBlockCell *cell) const { return false; }
@@ -86,19 +116,34 @@ namespace Game1 {
 		virtual bool equals (const GoalCell *cell) const { return false; }
 	};
 
+	// What heuristic () needs, found once when the level is loaded. Cells are numbered as
+	// in Map, x * height + y.
+	struct LevelTargets {
+		std::vector<int> doors;
+		// Steps from each cell to the nearest goal going around walls, -1 if there is no
+		// way, and which goal that is
+		std::vector<int> goal_distance;
+		std::vector<int> nearest_goal;
+	};
+
 	class StateImplementation : public State {
 		Player cass;
 		Map *diffmap;
 		const StateImplementation *original;
+		// Only in the state loaded from the file, the original of all the others
+		LevelTargets *targets;
 
 	public:
 		StateImplementation (const char *filename);
-		StateImplementation (const StateImplementation *original) {
+		StateImplementation (const StateImplementation *original) : targets (NULL) {
 			this->original = original;
 			diffmap = new Map (original->get_map_size_x (), original->get_map_size_y ());
 		}
 		~StateImplementation ();
 
+		static void *operator new (size_t size) { return Cass::allocate (size, MEMORY_STATES); }
+		static void operator delete (void *p, size_t size) { Cass::release (p, size, MEMORY_STATES); }
+
 		void render (float alpha) {
 			render (alpha, NULL);
 		}
@@ -107,6 +152,7 @@ namespace Game1 {
 		void input (Input input_code);
 
 		Player *get_cass () { return &cass; }
+		const Player *get_cass () const { return &cass; }
 
 		Cell *get_cell (int x, int y) {
 			Cell *cell = diffmap->get_cell (x, y);
@@ -131,6 +177,17 @@ namespace Game1 {
 			}
 		}
 
+		// Was the cell at (x, y) changed? Untouched cells are the original ones.
+		bool is_touched (int x, int y) const { return diffmap->get_cell (x, y) != NULL; }
+
+		// Is the cell at (x, y) the same as in another state of the same level?
+		bool cell_equals (int x, int y, const StateImplementation *other) const {
+			// Cells which were never touched are the original ones
+			if (diffmap->get_cell (x, y) == NULL && other->diffmap->get_cell (x, y) == NULL)
+				return true;
+			return get_cell (x, y)->equals (other->get_cell (x, y));
+		}
+
 		int get_map_size_x () const { return diffmap->get_sizex (); }
 		int get_map_size_y () const { return diffmap->get_sizey (); }
 
@@ -138,6 +195,10 @@ namespace Game1 {
 			return Cass::get_full_solver (get_map_size_x () * get_map_size_y (), NUM_INPUTS);
 		}
 
+		Cass::Solver *get_best_first_solver (int heuristic_weight) {
+			return Cass::get_best_first_solver (get_map_size_x () * get_map_size_y (), NUM_INPUTS, heuristic_weight);
+		}
+
 	private:
 		void render (float alpha, const StateImplementation *current = NULL) const {
 			for (int x = 0; x < get_map_size_x (); x++) {
@@ -158,15 +219,15 @@ namespace Game1 {
 		//
 		virtual bool equals (const Cass::State *virt_other) const {
 			const StateImplementation *other = (const StateImplementation *)virt_other;
+			g_num_equals_calls++;
+			// Same as comparing the packed states: a cell which was touched but is back to
+			// its original value equals an untouched one
+			if (!cass.equals (&other->cass))
+				return false;
 			for (int x = 0; x < get_map_size_x (); x++) {
 				for (int y = 0; y < get_map_size_y (); y++) {
-					if (diffmap->get_cell (x, y) == NULL && other->diffmap->get_cell (x, y) == NULL)
-						continue;
-					if (diffmap->get_cell (x, y) == NULL || other->diffmap->get_cell (x, y) == NULL)
+					if (!cell_equals (x, y, other))
 						return false;
-					const Cell *cell = get_cell (x, y);
-					const Cell *other_cell = other->get_cell (x, y);
-					if (!cell->equals (other_cell)) return false;
 				}
 			}
 			return true;
@@ -210,12 +271,30 @@ namespace Game1 {
 				return;
 			render (progress == Cass::State::GOAL ? 1.0f : 0.25f, (StateImplementation *)current);
 		}
+
+		virtual int pack (unsigned char *buffer, int buffer_size) const;
+		virtual Cass::State *unpack (const unsigned char *buffer, int size) const;
+		virtual int heuristic () const;
+
+		virtual int get_size () const {
+			int size = sizeof (*this) + sizeof (Map) + get_map_size_x () * get_map_size_y () * sizeof (Cell *);
+			for (int x = 0; x < get_map_size_x (); x++) {
+				for (int y = 0; y < get_map_size_y (); y++) {
+					const Cell *cell = diffmap->get_cell (x, y);
+					if (cell)
+						size += cell->get_size ();
+				}
+			}
+			return size;
+		}
 	};
 
 	struct EmptyCell : Cell {
 		EmptyCell (int x, int y) : Cell (x, y) {}
 		virtual void render (float alpha) const { g_renderer->renderEmptyCell (x, y, alpha); }
 		Cell *clone () const { return new EmptyCell (x, y); }
+		int get_size () const { return sizeof (*this); }
+		virtual unsigned char get_code () const { return CODE_EMPTY; }
 		virtual bool equals (const Cell *cell) const { return cell->equals (this); }
 		virtual bool equals (const EmptyCell *cell) const { return true; }
 
@@ -225,12 +304,19 @@ namespace Game1 {
 	struct FakeWall : EmptyCell {
 		FakeWall (int x, int y) : EmptyCell (x, y) {}
 		virtual void render (float alpha) const { g_renderer->renderWallCell (x, y, alpha); }
+		virtual unsigned char get_code () const { return CODE_FAKE_WALL; }
+		// Looks like a wall until it is revealed (cloned into an EmptyCell), so they differ
+		virtual bool equals (const Cell *cell) const { return cell->equals (this); }
+		virtual bool equals (const EmptyCell *cell) const { return false; }
+		virtual bool equals (const FakeWall *cell) const { return true; }
 	};
 
 	struct WallCell : Cell {
 		WallCell (int x, int y) : Cell (x, y) {}
 		virtual void render (float alpha) const { g_renderer->renderWallCell (x, y, alpha); }
 		Cell *clone () const { return new WallCell (x, y); }
+		int get_size () const { return sizeof (*this); }
+		virtual unsigned char get_code () const { return CODE_WALL; }
 		virtual bool equals (const Cell *cell) const { return cell->equals (this); }
 		virtual bool equals (const WallCell *cell) const { return true; }
 
@@ -241,6 +327,8 @@ namespace Game1 {
 		TrapCell (int x, int y) : Cell (x, y) {}
 		virtual void render (float alpha) const { g_renderer->renderTrapCell (x, y, alpha); }
 		Cell *clone () const { return new TrapCell (x, y); }
+		int get_size () const { return sizeof (*this); }
+		virtual unsigned char get_code () const { return CODE_TRAP; }
 		virtual bool equals (const Cell *cell) const { return cell->equals (this); }
 		virtual bool equals (const TrapCell *cell) const { return true; }
 
@@ -270,6 +358,9 @@ namespace Game1 {
 			return new PushableBlockCell (x, y, block_below->clone ());
 		}
 
+		virtual unsigned char get_code () const { return CODE_BLOCK | block_below->get_code (); }
+		int get_size () const { return sizeof (*this) + block_below->get_size (); }
+
 		virtual void toggle () {
 			block_below->toggle ();
 		}
@@ -280,9 +371,14 @@ namespace Game1 {
 		virtual bool can_pass (const StateImplementation *state, int incoming_dir) const {
 			int newx = x + dirs[incoming_dir][0];
 			int newy = y + dirs[incoming_dir][1];
-			return (state->get_cell (newx, newy)->can_pass (state, incoming_dir));
+			// Blocks don't stack: the one below would be hidden, and the packed state could
+			// not tell the stack from a single block
+			const Cell *next = state->get_cell (newx, newy);
+			return !next->is_block () && next->can_pass (state, incoming_dir);
 		}
 
+		virtual bool is_block () const { return true; }
+
 		virtual void pass (StateImplementation *state, int incoming_dir) {
 			int newx = x + dirs[incoming_dir][0];
 			int newy = y + dirs[incoming_dir][1];
@@ -310,6 +406,8 @@ namespace Game1 {
 		DoorCell (int x, int y, bool open) : Cell (x, y), open (open) {}
 		virtual void render (float alpha) const { g_renderer->renderDoorCell (x, y, open, alpha); }
 		Cell *clone () const { return new DoorCell (x, y, open); }
+		int get_size () const { return sizeof (*this); }
+		virtual unsigned char get_code () const { return CODE_DOOR | (open ? CODE_OPEN : 0); }
 		virtual bool equals (const Cell *cell) const { return cell->equals (this); }
 		virtual bool equals (const DoorCell *cell) const { return open == cell->open; }
 
@@ -326,6 +424,8 @@ namespace Game1 {
 		TriggerCell (int x, int y, int door_x, int door_y) : Cell (x, y), door_x (door_x), door_y (door_y) {}
 		virtual void render (float alpha) const { g_renderer->renderTriggerCell (x, y, alpha); }
 		Cell *clone () const { return new TriggerCell (x, y, door_x, door_y); }
+		int get_size () const { return sizeof (*this); }
+		virtual unsigned char get_code () const { return CODE_TRIGGER; }
 		virtual bool equals (const Cell *cell) const { return cell->equals (this); }
 		virtual bool equals (const TriggerCell *cell) const { return true; }
 
@@ -339,6 +439,8 @@ namespace Game1 {
 		GoalCell (int x, int y) : Cell (x, y) {}
 		virtual void render (float alpha) const { g_renderer->renderGoalCell (x, y, alpha); }
 		Cell *clone () const { return new GoalCell (x, y); }
+		int get_size () const { return sizeof (*this); }
+		virtual unsigned char get_code () const { return CODE_GOAL; }
 		virtual bool equals (const Cell *cell) const { return cell->equals (this); }
 		virtual bool equals (const GoalCell *cell) const { return true; }
 
@@ -348,6 +450,37 @@ namespace Game1 {
 		}
 	};
 
+	// Build a cell from its code. Triggers also need the position of their door, which
+	// is not part of the code.
+	static Cell *make_cell (unsigned char code, int x, int y, int door_x, int door_y) {
+		if (code & CODE_BLOCK)
+			return new PushableBlockCell (x, y, make_cell (code & ~CODE_BLOCK, x, y, door_x, door_y));
+
+		switch (code & CODE_KIND_MASK) {
+		case CODE_WALL: return new WallCell (x, y);
+		case CODE_TRAP: return new TrapCell (x, y);
+		case CODE_DOOR: return new DoorCell (x, y, (code & CODE_OPEN) != 0);
+		case CODE_TRIGGER: return new TriggerCell (x, y, door_x, door_y);
+		case CODE_GOAL: return new GoalCell (x, y);
+		case CODE_FAKE_WALL: return new FakeWall (x, y);
+		case CODE_EMPTY:
+		default: return new EmptyCell (x, y);
+		}
+	}
+
+	// Same, with the door of triggers taken from the original map
+	static Cell *make_cell (unsigned char code, int x, int y, const StateImplementation *original) {
+		int door_x = -1, door_y = -1;
+		if ((code & CODE_KIND_MASK) == CODE_TRIGGER) {
+			const Cell *cell = original->get_cell (x, y);
+			if (cell->get_code () & CODE_BLOCK)
+				cell = ((const PushableBlockCell *)cell)->block_below;
+			door_x = ((const TriggerCell *)cell)->door_x;
+			door_y = ((const TriggerCell *)cell)->door_y;
+		}
+		return make_cell (code, x, y, door_x, door_y);
+	}
+
 	Map::~Map () {
 		for (int x = 0; x < sizex; x++) {
 			for (int y = 0; y < sizey; y++) {
@@ -356,84 +489,413 @@ namespace Game1 {
 					delete cell;
 			}
 		}
-		delete []cells;
+		Cass::release_array (cells, sizex * sizey, MEMORY_MAPS);
 	}
 
-	StateImplementation::StateImplementation (const char *filename) {
-		FILE *f;
-		int width, height;
-		char *textmap;
+	// Layout of compiled levels, see compile_level (). Numbers are in the byte order of
+	// the machine which wrote them:
+	//  - LevelHeader
+	//  - unsigned char codes[width * height], the CellCode of each cell in Map order
+	//    (x * height + y), padded to 4 bytes
+	//  - int links[num_triggers * 2], the index of each trigger and of its door, with
+	//    the triggers in Map order
+	// Text maps are compiled to the same layout in memory when they are loaded, so both
+	// formats are turned into cells by the same code.
+	static const char LEVEL_MAGIC[4] = { 'C', 'G', '1', 'L' };
+	static const unsigned int LEVEL_VERSION = 1;
+
+	struct LevelHeader {
+		char magic[4];
+		unsigned int version;
+		int width;
+		int height;
+		int player_x;
+		int player_y;
+		int num_triggers;
+		// FNV-1a of everything after the header
+		unsigned int checksum;
+	};
 
-		original = NULL;
+	static long long get_codes_size (int width, int height) {
+		return ((long long)width * height + 3) & ~3;
+	}
 
-		f = fopen (filename, "rt");
-		if (!f) {
-			printf ("Could not open %s\n", filename);
-			throw 0;
+	static long long get_level_size (int width, int height, int num_triggers) {
+		return sizeof (LevelHeader) + get_codes_size (width, height) + 2LL * num_triggers * sizeof (int);
+	}
+
+	static unsigned int get_level_checksum (const std::vector<unsigned char> &level) {
+		unsigned int checksum = 2166136261u;
+		for (size_t i = sizeof (LevelHeader); i < level.size (); i++) {
+			checksum ^= level[i];
+			checksum *= 16777619u;
 		}
-		if (fscanf (f, "%d,%d\n", &width, &height) != 2) {
+		return checksum;
+	}
+
+	static bool is_compiled_level (const std::vector<unsigned char> &file) {
+		return file.size () >= sizeof (LevelHeader) && !memcmp (&file[0], LEVEL_MAGIC, sizeof (LEVEL_MAGIC));
+	}
+
+	// Characters allowed in map files, besides door and trigger letters
+	static bool is_map_char (char c) {
+		switch (c) {
+		case '#': case '@': case '.': case '|': case '^': case '%': case '*':
+			return true;
+		default:
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+		}
+	}
+
+	static bool is_space (char c) {
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	static unsigned char get_char_code (char c) {
+		switch (c) {
+		case '#': return CODE_WALL;
+		case '|': return CODE_FAKE_WALL;
+		case '^': return CODE_TRAP;
+		case '%': return CODE_BLOCK | CODE_EMPTY;
+		case '*': return CODE_GOAL;
+		default:
+			if (c >= 'a' && c <= 'z')
+				return CODE_TRIGGER;
+			if (c >= 'A' && c <= 'Z')
+				return CODE_DOOR;
+			return CODE_EMPTY;
+		}
+	}
+
+	// Check a text map and compile it into level. Returns false on errors.
+	static bool compile_text_level (const char *text, size_t size, std::vector<unsigned char> *level) {
+		const char *p = text, *end = text + size;
+		int width, height;
+
+		// sscanf might go through the whole text, so only give it the first line
+		char header[64];
+		int header_size = 0;
+		while (p + header_size < end && p[header_size] != '\n' && header_size < (int)sizeof (header) - 1) {
+			header[header_size] = p[header_size];
+			header_size++;
+		}
+		header[header_size] = 0;
+		if (sscanf (header, "%d,%d", &width, &height) != 2) {
 			printf ("Could not read map width & height from file\n");
-			throw 0;
+			return false;
 		}
-		if (width < 0 || width > 100 || height < 0 || height > 100) {
+		if (width <= 0 || height <= 0 || (long long)width * height > MAX_MAP_CELLS) {
 			printf ("Invalid map size %dx%d\n", width, height);
-			throw 0;
+			return false;
+		}
+		p += header_size;
+
+		// Rows are separated by any amount of white space, so line endings do not matter.
+		// Doors are found here too: a trigger opens the last door with its letter, in
+		// the order of the x coordinate first.
+		std::vector<const char *> rows (height);
+		int door_x[26], door_y[26];
+		// Position of some trigger of each letter, to complain if it has no door
+		int trigger_x[26], trigger_y[26];
+		int player_x = -1, player_y = -1;
+		int num_triggers = 0;
+		for (int i = 0; i < 26; i++)
+			door_x[i] = trigger_x[i] = -1;
+		for (int y = 0; y < height; y++) {
+			while (p < end && is_space (*p))
+				p++;
+			if (end - p < width) {
+				printf ("Map is shorter than %dx%d\n", width, height);
+				return false;
+			}
+			rows[y] = p;
+			for (int x = 0; x < width; x++) {
+				char c = p[x];
+				if (!is_map_char (c)) {
+					printf ("Unknown char '%c' at %d, %d\n", c, x, y);
+					return false;
+				}
+				if (c >= 'A' && c <= 'Z') {
+					int id = c - 'A';
+					if (x > door_x[id] || (x == door_x[id] && y > door_y[id])) {
+						door_x[id] = x;
+						door_y[id] = y;
+					}
+				} else if (c >= 'a' && c <= 'z') {
+					trigger_x[c - 'a'] = x;
+					trigger_y[c - 'a'] = y;
+					num_triggers++;
+				} else if (c == '@') {
+					player_x = x;
+					player_y = y;
+				}
+			}
+			p += width;
+		}
+		if (player_x < 0) {
+			printf ("There is no player in the map\n");
+			return false;
+		}
+		for (int i = 0; i < 26; i++) {
+			if (trigger_x[i] >= 0 && door_x[i] < 0) {
+				printf ("Trigger '%c' at %d, %d has no door\n", 'a' + i, trigger_x[i], trigger_y[i]);
+				return false;
+			}
 		}
-		diffmap = new Map (width, height);
 
-		textmap = new char[width * height];
-		memset (textmap, '.', width * height);
-		for (int y = 0; y < get_map_size_y (); y++) {
-			for (int x = 0; x < get_map_size_x (); x++) {
-				if (fscanf (f, "%c", &textmap[x * height + y]) != 1)
-					throw 0;
+		level->assign ((size_t)get_level_size (width, height, num_triggers), 0);
+		LevelHeader *level_header = (LevelHeader *)&(*level)[0];
+		memcpy (level_header->magic, LEVEL_MAGIC, sizeof (level_header->magic));
+		level_header->version = LEVEL_VERSION;
+		level_header->width = width;
+		level_header->height = height;
+		level_header->player_x = player_x;
+		level_header->player_y = player_y;
+		level_header->num_triggers = num_triggers;
+		unsigned char *codes = &(*level)[0] + sizeof (LevelHeader);
+		int *links = (int *)(codes + get_codes_size (width, height));
+		for (int x = 0; x < width; x++) {
+			for (int y = 0; y < height; y++) {
+				char c = rows[y][x];
+				*codes++ = get_char_code (c);
+				if (c >= 'a' && c <= 'z') {
+					*links++ = x * height + y;
+					*links++ = door_x[c - 'a'] * height + door_y[c - 'a'];
+				}
 			}
-			if (fscanf (f, "\n") != 0)
-				throw 0;
 		}
+		level_header->checksum = get_level_checksum (*level);
+		return true;
+	}
+
+	// Check what the compiler cannot have got wrong unless the file was damaged, and
+	// that every trigger has a link to a door. Returns false on errors.
+	static bool check_compiled_level (const std::vector<unsigned char> &level) {
+		const LevelHeader *header = (const LevelHeader *)&level[0];
+		if (header->version != LEVEL_VERSION) {
+			printf ("The level was compiled for version %u, not %u\n", header->version, LEVEL_VERSION);
+			return false;
+		}
+		if (header->width <= 0 || header->height <= 0 || (long long)header->width * header->height > MAX_MAP_CELLS ||
+				header->num_triggers < 0 || header->num_triggers > header->width * header->height ||
+				(long long)level.size () != get_level_size (header->width, header->height, header->num_triggers) ||
+				header->checksum != get_level_checksum (level)) {
+			printf ("The level is damaged\n");
+			return false;
+		}
+		if (header->player_x < 0 || header->player_x >= header->width || header->player_y < 0 || header->player_y >= header->height) {
+			printf ("There is no player in the map\n");
+			return false;
+		}
+
+		int num_cells = header->width * header->height;
+		const unsigned char *codes = &level[0] + sizeof (LevelHeader);
+		const int *links = (const int *)(codes + get_codes_size (header->width, header->height));
+		int num_triggers = 0;
+		for (int i = 0; i < num_cells; i++) {
+			if ((codes[i] & CODE_KIND_MASK) == CODE_TRIGGER)
+				num_triggers++;
+		}
+		bool ok = num_triggers == header->num_triggers;
+		for (int i = 0; i < header->num_triggers && ok; i++) {
+			int trigger = links[2 * i], door = links[2 * i + 1];
+			ok = trigger >= 0 && trigger < num_cells && (codes[trigger] & CODE_KIND_MASK) == CODE_TRIGGER &&
+				(i == 0 || trigger > links[2 * i - 2]) &&
+				door >= 0 && door < num_cells;
+		}
+		if (!ok) {
+			printf ("The triggers of the level do not match their doors\n");
+			return false;
+		}
+		return true;
+	}
+
+	// Read a text map or a compiled level into level, compiled and checked either way.
+	// Returns false on errors.
+	static bool load_level (const char *filename, std::vector<unsigned char> *level) {
+		FILE *f = fopen (filename, "rb");
+		if (!f) {
+			printf ("Could not open %s\n", filename);
+			return false;
+		}
+		std::vector<unsigned char> file;
+		if (fseek (f, 0, SEEK_END) == 0) {
+			long size = ftell (f);
+			if (size > 0)
+				file.resize ((size_t)size);
+			fseek (f, 0, SEEK_SET);
+		}
+		file.resize (file.empty () ? 0 : fread (&file[0], 1, file.size (), f));
 		fclose (f);
 
-		for (int y = 0; y < get_map_size_y (); y++) {
-			for (int x = 0; x < get_map_size_x (); x++) {
-				char c = textmap[x * height + y];
-				switch (c) {
-				case '#': diffmap->set_cell (x, y, new WallCell (x, y)); break;
-				case '@': cass.x = x; cass.y = y; // Deliberate fallthrough
-				case '.': diffmap->set_cell (x, y, new EmptyCell (x, y)); break;
-				case '|': diffmap->set_cell (x, y, new FakeWall (x, y)); break;
-				case '^': diffmap->set_cell (x, y, new TrapCell (x, y)); break;
-				case '%': diffmap->set_cell (x, y, new PushableBlockCell (x, y, new EmptyCell (x, y))); break;
-				case '*': diffmap->set_cell (x, y, new GoalCell (x, y)); break;
-				default:
-					if (c >= 'a' && c <= 'z') {
-						int id = c - 'a';
-						for (int sx = 0; sx < get_map_size_x (); sx++) {
-							for (int sy = 0; sy < get_map_size_y (); sy++) {
-								char sc = textmap[sx * height + sy];
-								if (sc == 'A' + id) {
-									DoorCell *door = new DoorCell (sx, sy, false);
-									diffmap->set_cell (sx, sy, door);
-									diffmap->set_cell (x, y, new TriggerCell (x, y, sx, sy));
-								}
-							}
-						}
-					} else
-						if (c < 'A' || c > 'Z') {
-							printf ("Unknown char '%c' at %d, %d", c, x, y);
-							throw 0;
-						}
-					break;
+		if (is_compiled_level (file)) {
+			if (!check_compiled_level (file))
+				return false;
+			level->swap (file);
+			return true;
+		}
+		return compile_text_level (file.empty () ? "" : (const char *)&file[0], file.size (), level);
+	}
+
+	bool compile_level (const char *filename, const char *output_filename) {
+		std::vector<unsigned char> level;
+		if (!load_level (filename, &level))
+			return false;
+
+		FILE *f = fopen (output_filename, "wb");
+		if (!f) {
+			printf ("Could not create %s\n", output_filename);
+			return false;
+		}
+		bool ok = fwrite (&level[0], 1, level.size (), f) == level.size ();
+		ok = (fclose (f) == 0) && ok;
+		if (!ok) {
+			printf ("Could not write %s\n", output_filename);
+			remove (output_filename);
+		}
+		return ok;
+	}
+
+	// Breadth-first search from all goals at once. Only walls stop the player for good:
+	// doors may open and traps may be filled.
+	static void find_targets (const unsigned char *codes, int width, int height, LevelTargets *targets) {
+		std::vector<int> queue;
+		targets->goal_distance.assign (width * height, -1);
+		targets->nearest_goal.assign (width * height, -1);
+		for (int i = 0; i < width * height; i++) {
+			if ((codes[i] & CODE_KIND_MASK) == CODE_DOOR)
+				targets->doors.push_back (i);
+			if ((codes[i] & CODE_KIND_MASK) == CODE_GOAL) {
+				targets->goal_distance[i] = 0;
+				targets->nearest_goal[i] = i;
+				queue.push_back (i);
+			}
+		}
+		for (size_t q = 0; q < queue.size (); q++) {
+			int x = queue[q] / height, y = queue[q] % height;
+			for (int d = 0; d < 4; d++) {
+				int nx = x + dirs[d][0], ny = y + dirs[d][1];
+				if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+					continue;
+				int next = nx * height + ny;
+				if (targets->goal_distance[next] >= 0 || (codes[next] & CODE_KIND_MASK) == CODE_WALL)
+					continue;
+				targets->goal_distance[next] = targets->goal_distance[queue[q]] + 1;
+				targets->nearest_goal[next] = targets->nearest_goal[queue[q]];
+				queue.push_back (next);
+			}
+		}
+	}
+
+	// Cells come straight from the compiled level: the codes are in Map order and the
+	// links of the triggers are met in the same order
+	StateImplementation::StateImplementation (const char *filename) {
+		original = NULL;
+		targets = NULL;
+
+		std::vector<unsigned char> level;
+		if (!load_level (filename, &level))
+			throw 0;
+
+		const LevelHeader *header = (const LevelHeader *)&level[0];
+		int width = header->width, height = header->height;
+		const unsigned char *codes = &level[0] + sizeof (LevelHeader);
+		const int *links = (const int *)(codes + get_codes_size (width, height));
+		diffmap = new Map (width, height);
+		targets = new LevelTargets;
+		find_targets (codes, width, height, targets);
+		for (int x = 0; x < width; x++) {
+			for (int y = 0; y < height; y++) {
+				unsigned char code = *codes++;
+				int door_x = -1, door_y = -1;
+				if ((code & CODE_KIND_MASK) == CODE_TRIGGER) {
+					door_x = links[1] / height;
+					door_y = links[1] % height;
+					links += 2;
 				}
+				diffmap->set_cell (x, y, make_cell (code, x, y, door_x, door_y));
 			}
 		}
-		delete []textmap;
 
+		cass.x = header->player_x;
+		cass.y = header->player_y;
 		cass.dead = false;
 		cass.won = false;
 	}
 
 	StateImplementation::~StateImplementation () {
 		delete diffmap;
+		delete targets;
+	}
+
+	// Steps to the nearest goal going around walls, plus one for every closed door in
+	// the rectangle between the player and that goal, which must be opened or walked
+	// around
+	int StateImplementation::heuristic () const {
+		if (cass.won)
+			return 0;
+		const LevelTargets *level = (original ? original : this)->targets;
+		int height = get_map_size_y ();
+		int player = cass.x * height + cass.y;
+		int distance = level->goal_distance[player];
+		if (distance < 0)
+			return get_map_size_x () * height;
+
+		int goal_x = level->nearest_goal[player] / height, goal_y = level->nearest_goal[player] % height;
+		for (size_t d = 0; d < level->doors.size (); d++) {
+			int door_x = level->doors[d] / height, door_y = level->doors[d] % height;
+			if ((door_x - cass.x) * (door_x - goal_x) > 0 || (door_y - cass.y) * (door_y - goal_y) > 0)
+				continue;
+			if (!(get_cell (door_x, door_y)->get_code () & CODE_OPEN))
+				distance++;
+		}
+		return distance;
+	}
+
+	// Packed states hold the player followed by the index and code of every cell
+	// which is different from the original map.
+	int StateImplementation::pack (unsigned char *buffer, int buffer_size) const {
+		int size = 2 * sizeof (int) + 1;
+		if (size <= buffer_size) {
+			memcpy (buffer, &cass.x, sizeof (int));
+			memcpy (buffer + sizeof (int), &cass.y, sizeof (int));
+			buffer[2 * sizeof (int)] = (cass.dead ? 1 : 0) | (cass.won ? 2 : 0);
+		}
+		if (!original)
+			return size;
+
+		for (int x = 0; x < get_map_size_x (); x++) {
+			for (int y = 0; y < get_map_size_y (); y++) {
+				const Cell *cell = diffmap->get_cell (x, y);
+				if (!cell || cell->equals (original->get_cell (x, y)))
+					continue;
+				if (size + (int)sizeof (int) + 1 <= buffer_size) {
+					int index = x * get_map_size_y () + y;
+					memcpy (buffer + size, &index, sizeof (int));
+					buffer[size + sizeof (int)] = cell->get_code ();
+				}
+				size += sizeof (int) + 1;
+			}
+		}
+		return size;
+	}
+
+	Cass::State *StateImplementation::unpack (const unsigned char *buffer, int size) const {
+		const StateImplementation *base = original ? original : this;
+		StateImplementation *state = new StateImplementation (base);
+		memcpy (&state->cass.x, buffer, sizeof (int));
+		memcpy (&state->cass.y, buffer + sizeof (int), sizeof (int));
+		state->cass.dead = (buffer[2 * sizeof (int)] & 1) != 0;
+		state->cass.won = (buffer[2 * sizeof (int)] & 2) != 0;
+
+		for (int offset = 2 * sizeof (int) + 1; offset + (int)sizeof (int) < size; offset += sizeof (int) + 1) {
+			int index;
+			memcpy (&index, buffer + offset, sizeof (int));
+			int x = index / get_map_size_y ();
+			int y = index % get_map_size_y ();
+			state->diffmap->set_cell (x, y, make_cell (buffer[offset + sizeof (int)], x, y, base));
+		}
+		return state;
 	}
 
 	bool StateImplementation::can_input (Input input_code) const {
@@ -487,7 +949,116 @@ namespace Game1 {
 		}
 	}
 
+	// Player flags in GhostField
+	enum GhostPlayerCode {
+		GHOST_PLAYER_DEAD = 0x01,
+		GHOST_PLAYER_WON = 0x02
+	};
+
+	GhostField::~GhostField () {
+		delete[] cells;
+		delete[] players;
+	}
+
+	void GhostField::add_ghost (GhostCell *cell, Cass::State::Progress progress, unsigned char code) {
+		if (!cell->count || progress > cell->progress) {
+			cell->progress = progress;
+			cell->code = code;
+		}
+		cell->count++;
+	}
+
+	// Same transparency as StateImplementation::render_ghosts (), where overlapping
+	// ghosts add up
+	float GhostField::get_alpha (const GhostCell *cell) {
+		if (cell->progress == Cass::State::GOAL)
+			return 1.0f;
+		float alpha = 0.25f * cell->count;
+		return alpha < 1.0f ? alpha : 1.0f;
+	}
+
+	void GhostField::build (Cass::Solver *solver, int distance, const State *current_state) {
+		const StateImplementation *current = (const StateImplementation *)current_state;
+		if (current->get_map_size_x () * current->get_map_size_y () != sizex * sizey) {
+			delete[] cells;
+			delete[] players;
+			cells = new GhostCell[current->get_map_size_x () * current->get_map_size_y ()];
+			players = new GhostCell[current->get_map_size_x () * current->get_map_size_y ()];
+		}
+		sizex = current->get_map_size_x ();
+		sizey = current->get_map_size_y ();
+		memset (cells, 0, sizex * sizey * sizeof (GhostCell));
+		memset (players, 0, sizex * sizey * sizeof (GhostCell));
+
+		// Cells which neither a ghost nor the current state touched are the original ones
+		// in both, so only the touched cells are compared
+		std::vector<int> current_touched;
+		for (int x = 0; x < sizex; x++) {
+			for (int y = 0; y < sizey; y++) {
+				if (current->is_touched (x, y))
+					current_touched.push_back (x * sizey + y);
+			}
+		}
+
+		for (int i = 0; i < solver->get_layer_size (distance); i++) {
+			Cass::State::Progress progress;
+			const StateImplementation *ghost = (const StateImplementation *)solver->get_layer_state (distance, i, &progress);
+			if (progress == Cass::State::DEAD_END)
+				continue;
+
+			for (int x = 0; x < sizex; x++) {
+				for (int y = 0; y < sizey; y++) {
+					if (ghost->is_touched (x, y) && !ghost->get_cell (x, y)->equals (current->get_cell (x, y)))
+						add_ghost (&cells[x * sizey + y], progress, ghost->get_cell (x, y)->get_code ());
+				}
+			}
+			for (size_t j = 0; j < current_touched.size (); j++) {
+				int x = current_touched[j] / sizey;
+				int y = current_touched[j] % sizey;
+				if (!ghost->is_touched (x, y) && !ghost->get_cell (x, y)->equals (current->get_cell (x, y)))
+					add_ghost (&cells[x * sizey + y], progress, ghost->get_cell (x, y)->get_code ());
+			}
+
+			const Player *cass = ghost->get_cass ();
+			if (!cass->equals (current->get_cass ())) {
+				unsigned char code = (cass->dead ? GHOST_PLAYER_DEAD : 0) | (cass->won ? GHOST_PLAYER_WON : 0);
+				add_ghost (&players[cass->x * sizey + cass->y], progress, code);
+			}
+		}
+	}
+
+	void GhostField::render () {
+		for (int x = 0; x < sizex; x++) {
+			for (int y = 0; y < sizey; y++) {
+				const GhostCell *cell = &cells[x * sizey + y];
+				if (cell->count) {
+					float alpha = get_alpha (cell);
+					if (cell->code & CODE_BLOCK) {
+						g_renderer->renderPushableBlockCell (x, y, alpha);
+					} else {
+						switch (cell->code & CODE_KIND_MASK) {
+						case CODE_EMPTY: g_renderer->renderEmptyCell (x, y, alpha); break;
+						case CODE_WALL: g_renderer->renderWallCell (x, y, alpha); break;
+						case CODE_TRAP: g_renderer->renderTrapCell (x, y, alpha); break;
+						case CODE_DOOR: g_renderer->renderDoorCell (x, y, (cell->code & CODE_OPEN) != 0, alpha); break;
+						case CODE_TRIGGER: g_renderer->renderTriggerCell (x, y, alpha); break;
+						case CODE_GOAL: g_renderer->renderGoalCell (x, y, alpha); break;
+						case CODE_FAKE_WALL: g_renderer->renderWallCell (x, y, alpha); break;
+						}
+					}
+				}
+
+				const GhostCell *player = &players[x * sizey + y];
+				if (player->count) {
+					g_renderer->renderPlayer (x, y, (player->code & GHOST_PLAYER_DEAD) != 0,
+						(player->code & GHOST_PLAYER_WON) != 0, get_alpha (player));
+				}
+			}
+		}
+	}
+
 	State *load_state (const char *filename) {
+		CASS_TRACE ("load level");
 		StateImplementation *state = NULL;
 		try {
 			state = new StateImplementation (filename);
@@ -34,6 +34,10 @@ namespace Game1 {
 
 	extern Renderer *g_renderer;
 
+	// Number of state comparisons so far in this thread, for benchmarks. Solvers compare
+	// states in the thread which calls process (), and several solvers may run at once.
+	extern thread_local long long g_num_equals_calls;
+
 	// This represents the game state. Applications use this interface to interact with the game.
 	class State : public Cass::State {
 	public:
@@ -56,9 +60,48 @@ namespace Game1 {
 
 		// Get a solver
 		virtual Cass::Solver *get_solver () = 0;
+		// Get a solver which looks for a path to the goal first, see Cass::get_best_first_solver ()
+		virtual Cass::Solver *get_best_first_solver (int heuristic_weight) = 0;
 	};
 
+	// Load a text map or a level compiled by compile_level (), whichever the file holds
 	State *load_state (const char *filename);
+
+	// Check a map and write it as a compiled level, which loads without parsing. Returns
+	// false on errors.
+	bool compile_level (const char *filename, const char *output_filename);
+
+	// The ghosts at one distance from the current state, merged per cell. Rendering each
+	// ghost compares and draws the whole map once per ghost, this draws each cell at most
+	// once however many ghosts there are.
+	class GhostField {
+	public:
+		GhostField () : sizex (0), sizey (0), cells (0), players (0) {}
+		~GhostField ();
+
+		// Merge the ghosts of the solver's last view state at this distance
+		void build (Cass::Solver *solver, int distance, const State *current);
+		// Render the merged ghosts in a single pass over the map
+		void render ();
+
+	private:
+		struct GhostCell {
+			// Highest Progress of the ghosts which are different from the current state here
+			Cass::State::Progress progress;
+			// Number of those ghosts
+			int count;
+			// What the one with the highest Progress has here: cell code, or player flags
+			unsigned char code;
+		};
+
+		int sizex;
+		int sizey;
+		GhostCell *cells;
+		GhostCell *players;
+
+		static void add_ghost (GhostCell *cell, Cass::State::Progress progress, unsigned char code);
+		static float get_alpha (const GhostCell *cell);
+	};
 }
 
 #endif
\ No newline at end of file
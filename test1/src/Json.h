@@ -0,0 +1,72 @@
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string>
+
+// The little JSON the command line tools write and read back: strings are quoted and
+// escaped here, everything else is written with printf.
+
+// text as a quoted JSON string
+inline std::string json_string (const std::string &text) {
+	std::string quoted = "\"";
+	for (size_t i = 0; i < text.size (); i++) {
+		char c = text[i];
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += c;
+		} else if ((unsigned char)c < 0x20) {
+			char escape[8];
+			snprintf (escape, sizeof (escape), "\\u%04x", c);
+			quoted += escape;
+		} else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+// Read a string written by json_string (), p pointing at the opening quote. Returns
+// the character after the closing quote, or NULL if the string is not valid.
+inline const char *json_read_string (const char *p, std::string *text) {
+	if (*p != '"')
+		return NULL;
+	text->clear ();
+	for (p++; *p != '"'; p++) {
+		if (*p == '\0')
+			return NULL;
+		if (*p != '\\') {
+			*text += *p;
+			continue;
+		}
+		p++;
+		switch (*p) {
+		case '"': case '\\': case '/': *text += *p; break;
+		case 'b': *text += '\b'; break;
+		case 'f': *text += '\f'; break;
+		case 'n': *text += '\n'; break;
+		case 'r': *text += '\r'; break;
+		case 't': *text += '\t'; break;
+		case 'u': {
+			// Only control characters are written like this
+			unsigned int code = 0;
+			for (int i = 1; i <= 4; i++) {
+				if (!isxdigit ((unsigned char)p[i]))
+					return NULL;
+			}
+			sscanf (p + 1, "%4x", &code);
+			if (code >= 0x20)
+				return NULL;
+			*text += (char)code;
+			p += 4;
+			break;
+		}
+		default:
+			return NULL;
+		}
+	}
+	return p + 1;
+}
+
+#endif
@@ -0,0 +1,3 @@
+#!/bin/sh
+# The solver and every explorer must find the same number of states on the same map
+exec ./test1Performance -check-explorers . "${srcdir:-.}/test1-map.txt"